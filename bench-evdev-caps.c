@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2015 Vladimir Kondratyev <wulf@cicgroup.ru>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Compares evdev_caps_classify() against the bit-by-bit classification it
+ * replaced on random capability bitmaps. Both have to agree on every
+ * bitmap, time spent by each is reported.
+ */
+
+#include "config.h"
+#include "evdev-caps.h"
+#include "udev-utils.h"
+#include "utils.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_LINUX_INPUT_H
+
+/* Distinct bitmaps cycled through, so the working set stays in cache */
+#define	BENCH_CAPS	256
+
+static bool
+bit_find_bitwise(const unsigned long *array, int start, int stop)
+{
+	int i;
+
+	for (i = start; i < stop; i++)
+		if (bit_is_set(array, i))
+			return true;
+
+	return false;
+}
+
+/* Classification as done in create_evdev_handler() before evdev-caps.c */
+static int
+classify_bitwise(const struct evdev_caps *caps)
+{
+	const unsigned long *key_bits = caps->key_bits;
+	const unsigned long *rel_bits = caps->rel_bits;
+	const unsigned long *abs_bits = caps->abs_bits;
+	bool has_keys, has_buttons, has_lmr;
+	bool has_rel_axes, has_abs_axes, has_mt;
+
+	has_keys = bit_find_bitwise(key_bits, 0, BTN_MISC);
+	has_buttons = bit_find_bitwise(key_bits, BTN_MISC, BTN_JOYSTICK);
+	has_lmr = bit_find_bitwise(key_bits, BTN_LEFT, BTN_MIDDLE + 1);
+	has_rel_axes = bit_find_bitwise(rel_bits, 0, REL_CNT);
+	has_abs_axes = bit_find_bitwise(abs_bits, 0, ABS_CNT);
+	has_mt = bit_find_bitwise(abs_bits, ABS_MT_SLOT, ABS_CNT);
+
+	if (has_abs_axes) {
+		if (has_mt && !has_buttons) {
+			if (bit_is_set(key_bits, BTN_JOYSTICK))
+				return (IT_JOYSTICK);
+			else
+				has_buttons = true;
+		}
+
+		if (bit_is_set(abs_bits, ABS_X) &&
+		    bit_is_set(abs_bits, ABS_Y)) {
+			if (bit_is_set(key_bits, BTN_TOOL_PEN) ||
+			    bit_is_set(key_bits, BTN_STYLUS) ||
+			    bit_is_set(key_bits, BTN_STYLUS2)) {
+				return (IT_TABLET);
+			} else if (bit_is_set(abs_bits, ABS_PRESSURE) ||
+			           bit_is_set(key_bits, BTN_TOUCH)) {
+				if (has_lmr ||
+				    bit_is_set(key_bits, BTN_TOOL_FINGER))
+					return (IT_TOUCHPAD);
+				else
+					return (IT_TOUCHSCREEN);
+			} else if (!(bit_is_set(rel_bits, REL_X) &&
+			             bit_is_set(rel_bits, REL_Y)) &&
+			             has_lmr) {
+				return (IT_TOUCHSCREEN);
+			}
+		}
+	}
+
+	if (has_keys)
+		return (IT_KEYBOARD);
+	else if (has_rel_axes || has_abs_axes || has_buttons)
+		return (IT_MOUSE);
+
+	return (IT_NONE);
+}
+
+static void
+bit_set(unsigned long *array, int bit)
+{
+
+	array[bit / LONG_BITS] |= 1UL << (bit % LONG_BITS);
+}
+
+/*
+ * Real devices set few bits, so most ranges scanned by classification come
+ * out empty. Pointer-like bits are made more likely than the rest.
+ */
+static void
+caps_random(struct evdev_caps *caps)
+{
+	int i, n;
+
+	memset(caps, 0, sizeof(*caps));
+	n = random() % 8;
+	for (i = 0; i < n; i++) {
+		switch (random() % 4) {
+		case 0:
+			bit_set(caps->key_bits, random() % KEY_CNT);
+			break;
+		case 1:
+			bit_set(caps->key_bits, BTN_MISC +
+			    random() % (BTN_DIGI + 0x10 - BTN_MISC));
+			break;
+		case 2:
+			bit_set(caps->rel_bits, random() % REL_CNT);
+			break;
+		default:
+			bit_set(caps->abs_bits, random() % ABS_CNT);
+			break;
+		}
+	}
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: bench-evdev-caps [-n iterations]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	static struct evdev_caps caps[BENCH_CAPS];
+	unsigned long n = 1000000, i;
+	uint64_t start, usec_bitwise, usec_words;
+	int ch, j, sum_bitwise = 0, sum_words = 0;
+
+	while ((ch = getopt(argc, argv, "n:")) != -1) {
+		switch (ch) {
+		case 'n':
+			n = strtoul(optarg, NULL, 10);
+			if (n == 0)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc != optind)
+		usage();
+
+	srandom(1);
+	for (j = 0; j < BENCH_CAPS; j++) {
+		caps_random(&caps[j]);
+		if (classify_bitwise(&caps[j]) !=
+		    evdev_caps_classify(&caps[j])) {
+			fprintf(stderr, "classification mismatch\n");
+			return (1);
+		}
+	}
+
+	/* Sums keep compiler from dropping the calls */
+	start = monotonic_usec();
+	for (i = 0; i < n; i++)
+		sum_bitwise += classify_bitwise(&caps[i % BENCH_CAPS]);
+	usec_bitwise = monotonic_usec() - start;
+
+	start = monotonic_usec();
+	for (i = 0; i < n; i++)
+		sum_words += evdev_caps_classify(&caps[i % BENCH_CAPS]);
+	usec_words = monotonic_usec() - start;
+
+	if (sum_bitwise != sum_words) {
+		fprintf(stderr, "classification mismatch\n");
+		return (1);
+	}
+	printf("bitwise %10.1f ns/device\n", usec_bitwise * 1000.0 / n);
+	printf("words   %10.1f ns/device\n", usec_words * 1000.0 / n);
+	return (0);
+}
+
+#else /* !HAVE_LINUX_INPUT_H */
+
+int
+main(void)
+{
+
+	fprintf(stderr, "bench-evdev-caps: built without evdev support\n");
+	return (1);
+}
+
+#endif /* HAVE_LINUX_INPUT_H */
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2015 Vladimir Kondratyev <wulf@cicgroup.ru>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Measures per-event cost of the monitor event loop backend selected at
+ * configure time (kqueue or epoll). Wakeup round trips and socket read
+ * readiness are timed separately.
+ */
+
+#include "config.h"
+#include "event-loop.h"
+#include "utils.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_EVENT_H
+#define	BACKEND	"kqueue"
+#else
+#define	BACKEND	"epoll"
+#endif
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: bench-event-loop [-n iterations]\n");
+	exit(1);
+}
+
+static void
+report(const char *name, unsigned long n, uint64_t usec)
+{
+
+	printf("%-8s %-8s %10lu events %10.1f ns/event\n", BACKEND, name, n,
+	    n != 0 ? usec * 1000.0 / n : 0.0);
+}
+
+static int
+bench_wakeup(struct event_loop *el, unsigned long n)
+{
+	struct event_loop_event ele[EVENT_LOOP_MAX_EVENTS];
+	unsigned long i;
+	uint64_t start;
+
+	start = monotonic_usec();
+	for (i = 0; i < n; i++) {
+		if (event_loop_wakeup(el) < 0 ||
+		    event_loop_wait(el, ele, EVENT_LOOP_MAX_EVENTS, -1) != 1 ||
+		    ele[0].type != EVENT_LOOP_WAKEUP)
+			return (-1);
+	}
+	report("wakeup", n, monotonic_usec() - start);
+	return (0);
+}
+
+static int
+bench_read(struct event_loop *el, unsigned long n)
+{
+	struct event_loop_event ele[EVENT_LOOP_MAX_EVENTS];
+	unsigned long i;
+	uint64_t start;
+	int sv[2];
+	char c = 0;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+		return (-1);
+	if (event_loop_add_read(el, sv[0]) < 0)
+		goto error;
+
+	start = monotonic_usec();
+	for (i = 0; i < n; i++) {
+		if (write(sv[1], &c, 1) != 1 ||
+		    event_loop_wait(el, ele, EVENT_LOOP_MAX_EVENTS, -1) != 1 ||
+		    ele[0].type != EVENT_LOOP_READ ||
+		    read(sv[0], &c, 1) != 1)
+			goto error;
+	}
+	report("read", n, monotonic_usec() - start);
+
+	close(sv[0]);
+	close(sv[1]);
+	return (0);
+error:
+	close(sv[0]);
+	close(sv[1]);
+	return (-1);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct event_loop el;
+	unsigned long n = 100000;
+	int ch, ret;
+
+	while ((ch = getopt(argc, argv, "n:")) != -1) {
+		switch (ch) {
+		case 'n':
+			n = strtoul(optarg, NULL, 10);
+			if (n == 0)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc != optind)
+		usage();
+
+	if (event_loop_init(&el) < 0) {
+		perror("event_loop_init");
+		return (1);
+	}
+	ret = bench_wakeup(&el, n) < 0 || bench_read(&el, n) < 0;
+	if (ret != 0)
+		perror("bench-event-loop");
+	event_loop_close(&el);
+	return (ret);
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2015 Vladimir Kondratyev <wulf@cicgroup.ru>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Measures repeated udev_device_new_from_devnum() lookups of given device
+ * nodes, first with no monitor and then with a receiving one keeping the
+ * devnum index current. The second pass needs devd (or devd-replay)
+ * listening on the socket libudev connects to.
+ */
+
+#include "config.h"
+#include "libudev.h"
+#include "utils.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: bench-lookup [-n iterations] device ...\n");
+	exit(1);
+}
+
+static int
+bench(struct udev *udev, const char *name, dev_t *devnums, int ndevs,
+    unsigned long n)
+{
+	struct udev_device *ud;
+	unsigned long i;
+	uint64_t start;
+	int j;
+
+	start = monotonic_usec();
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < ndevs; j++) {
+			ud = udev_device_new_from_devnum(udev, 'c',
+			    devnums[j]);
+			if (ud == NULL)
+				return (-1);
+			udev_device_unref(ud);
+		}
+	}
+	printf("%-8s %10lu lookups %10.1f ns/lookup\n", name, n * ndevs,
+	    (monotonic_usec() - start) * 1000.0 / (n * ndevs));
+	return (0);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct udev *udev;
+	struct udev_monitor *um;
+	struct udev_enumerate *ue;
+	struct stat st;
+	dev_t *devnums;
+	unsigned long n = 10000;
+	int ch, i, ret;
+
+	while ((ch = getopt(argc, argv, "n:")) != -1) {
+		switch (ch) {
+		case 'n':
+			n = strtoul(optarg, NULL, 10);
+			if (n == 0)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc == 0)
+		usage();
+
+	devnums = calloc(argc, sizeof(dev_t));
+	if (devnums == NULL)
+		return (1);
+	for (i = 0; i < argc; i++) {
+		if (stat(argv[i], &st) < 0 || !S_ISCHR(st.st_mode)) {
+			fprintf(stderr, "%s: not a character device\n",
+			    argv[i]);
+			return (1);
+		}
+		devnums[i] = st.st_rdev;
+	}
+
+	udev = udev_new();
+	if (udev == NULL)
+		return (1);
+	ret = bench(udev, "plain", devnums, argc, n);
+
+	/* Index is trusted once monitor is connected and /dev is walked */
+	um = udev_monitor_new_from_netlink(udev, "udev");
+	if (ret == 0 && um != NULL && udev_monitor_enable_receiving(um) == 0) {
+		usleep(100000);
+		ue = udev_enumerate_new(udev);
+		if (ue != NULL) {
+			udev_enumerate_scan_devices(ue);
+			udev_enumerate_unref(ue);
+		}
+		ret = bench(udev, "indexed", devnums, argc, n);
+	}
+	if (ret != 0)
+		fprintf(stderr, "bench-lookup: lookup failed\n");
+
+	if (um != NULL)
+		udev_monitor_unref(um);
+	udev_unref(udev);
+	free(devnums);
+	return (ret != 0);
+}
@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2015 Vladimir Kondratyev <wulf@cicgroup.ru>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Records devd event stream with timestamps and replays it through local
+ * UNIX socket standing in for devd one. With -p replay socket is of
+ * SOCK_SEQPACKET type and every message is sent as a separate packet.
+ *
+ * Record file consists of lines "<usec since first event> <devd message>".
+ * The same format is written by libudev itself if LIBUDEV_DEVD_RECORD
+ * environment variable points to a file.
+ */
+
+#include "config.h"
+#include "udev-utils.h"
+#include "utils.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Replay must not take over socket of running devd */
+#define	REPLAY_SOCK_PATH	"/tmp/devd-replay.pipe"
+
+static void
+usage(void)
+{
+
+	fprintf(stderr,
+	    "usage: devd-replay record [-s socket] file\n"
+	    "       devd-replay replay [-p] [-s socket] [-x speed | -f] file\n");
+	exit(1);
+}
+
+static int
+record(const char *sock_path, const char *file)
+{
+	FILE *in, *out;
+	char line[8192];
+	uint64_t start = 0, now;
+	int fd;
+
+	fd = socket_connect(sock_path, SOCK_STREAM);
+	if (fd < 0) {
+		perror(sock_path);
+		return (1);
+	}
+	in = fdopen(fd, "r");
+	out = fopen(file, "w");
+	if (in == NULL || out == NULL) {
+		perror(file);
+		return (1);
+	}
+
+	while (fgets(line, sizeof(line), in) != NULL) {
+		now = monotonic_usec();
+		if (start == 0)
+			start = now;
+		fprintf(out, "%ju %s", (uintmax_t)(now - start), line);
+		if (strchr(line, '\n') == NULL)
+			fputc('\n', out);
+		fflush(out);
+	}
+
+	fclose(out);
+	fclose(in);
+	return (0);
+}
+
+/* Sleeps until usec microseconds past start */
+static void
+wait_until(uint64_t start, uint64_t usec)
+{
+	struct timespec ts;
+	uint64_t now;
+
+	now = monotonic_usec();
+	if (now >= start + usec)
+		return;
+	usec = start + usec - now;
+	ts.tv_sec = usec / 1000000;
+	ts.tv_nsec = (usec % 1000000) * 1000;
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+		;
+}
+
+/* Removes socket unless it has been replaced since it was bound */
+static void
+unlink_socket(const char *sock_path, const struct stat *bound)
+{
+	struct stat st;
+
+	if (lstat(sock_path, &st) == 0 && S_ISSOCK(st.st_mode) &&
+	    st.st_dev == bound->st_dev && st.st_ino == bound->st_ino)
+		unlink(sock_path);
+}
+
+static int
+replay(const char *sock_path, const char *file, double speed, int type)
+{
+	struct sockaddr_un sa;
+	struct stat st;
+	FILE *in;
+	char line[8192], *msg, *end;
+	uint64_t start, stamp;
+	unsigned long events = 0;
+	size_t len;
+	int lfd, fd;
+
+	in = fopen(file, "r");
+	if (in == NULL) {
+		perror(file);
+		return (1);
+	}
+
+	lfd = socket(AF_UNIX, type, 0);
+	if (lfd < 0) {
+		perror("socket");
+		return (1);
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	if (strlcpy(sa.sun_path, sock_path, sizeof(sa.sun_path)) >=
+	    sizeof(sa.sun_path)) {
+		fprintf(stderr, "%s: socket path too long\n", sock_path);
+		return (1);
+	}
+	/* Existing file is never removed, it can be somebody else's socket */
+	if (bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		perror(sock_path);
+		return (1);
+	}
+	if (stat(sock_path, &st) < 0) {
+		perror(sock_path);
+		return (1);
+	}
+	if (listen(lfd, 1) < 0) {
+		perror(sock_path);
+		unlink_socket(sock_path, &st);
+		return (1);
+	}
+
+	/* Replay starts when the first client has connected */
+	fd = accept(lfd, NULL, NULL);
+	if (fd < 0) {
+		perror("accept");
+		unlink_socket(sock_path, &st);
+		return (1);
+	}
+
+	start = monotonic_usec();
+	while (fgets(line, sizeof(line), in) != NULL) {
+		stamp = strtoull(line, &end, 10);
+		if (end == line || *end != ' ')
+			continue;
+		msg = end + 1;
+		if (speed > 0)
+			wait_until(start, stamp / speed);
+		len = strlen(msg);
+		if (write(fd, msg, len) != (ssize_t)len) {
+			perror("write");
+			break;
+		}
+		events++;
+	}
+
+	fprintf(stderr, "%lu events replayed in %ju usec\n", events,
+	    (uintmax_t)(monotonic_usec() - start));
+	close(fd);
+	close(lfd);
+	unlink_socket(sock_path, &st);
+	fclose(in);
+	return (0);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *sock_path = NULL;
+	double speed = 1.0;
+	int type = SOCK_STREAM;
+	bool do_record;
+	int ch;
+
+	if (argc < 2)
+		usage();
+	if (strcmp(argv[1], "record") == 0)
+		do_record = true;
+	else if (strcmp(argv[1], "replay") == 0)
+		do_record = false;
+	else
+		usage();
+	argc--;
+	argv++;
+
+	while ((ch = getopt(argc, argv, "fps:x:")) != -1) {
+		switch (ch) {
+		case 'f':
+			speed = 0;
+			break;
+		case 'p':
+			type = SOCK_SEQPACKET;
+			break;
+		case 's':
+			sock_path = optarg;
+			break;
+		case 'x':
+			speed = strtod(optarg, NULL);
+			if (speed <= 0)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1)
+		usage();
+
+	if (sock_path == NULL)
+		sock_path = do_record ? DEVD_SOCK_PATH : REPLAY_SOCK_PATH;
+
+	signal(SIGPIPE, SIG_IGN);
+	return (do_record ?
+	    record(sock_path, argv[0]) :
+	    replay(sock_path, argv[0], speed, type));
+}
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2015 Vladimir Kondratyev <wulf@cicgroup.ru>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#ifdef HAVE_LINUX_INPUT_H
+
+#include <sys/param.h>
+
+#include "evdev-caps.h"
+#include "udev-list.h"
+#include "udev-utils.h"
+
+#include <linux/input.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * Checks if any bit in [start, stop) range is set. Whole words are tested
+ * at once, only boundary words need masking.
+ */
+bool
+bit_find(const unsigned long *array, int start, int stop)
+{
+	unsigned long first_mask, last_mask, acc;
+	int first, last, i;
+
+	if (start >= stop)
+		return (false);
+
+	first = start / LONG_BITS;
+	last = (stop - 1) / LONG_BITS;
+	first_mask = ~0UL << (start % LONG_BITS);
+	last_mask = ~0UL >> (LONG_BITS - 1 - (stop - 1) % LONG_BITS);
+
+	if (first == last)
+		return ((array[first] & first_mask & last_mask) != 0);
+
+	acc = array[first] & first_mask;
+	for (i = first + 1; i < last; i++)
+		acc |= array[i];
+	acc |= array[last] & last_mask;
+
+	return (acc != 0);
+}
+
+/*
+ * Returns IT_* input type of evdev device.
+ * Derived from EvdevProbe() function of xf86-input-evdev driver
+ */
+int
+evdev_caps_classify(const struct evdev_caps *caps)
+{
+	const unsigned long *key_bits = caps->key_bits;
+	const unsigned long *rel_bits = caps->rel_bits;
+	const unsigned long *abs_bits = caps->abs_bits;
+	bool has_keys, has_buttons, has_lmr;
+	bool has_rel_axes, has_abs_axes, has_mt;
+
+	has_keys = bit_find(key_bits, 0, BTN_MISC);
+	has_buttons = bit_find(key_bits, BTN_MISC, BTN_JOYSTICK);
+	has_lmr = bit_find(key_bits, BTN_LEFT, BTN_MIDDLE + 1);
+	has_rel_axes = bit_find(rel_bits, 0, REL_CNT);
+	has_abs_axes = bit_find(abs_bits, 0, ABS_CNT);
+	has_mt = bit_find(abs_bits, ABS_MT_SLOT, ABS_CNT);
+
+	if (has_abs_axes) {
+		if (has_mt && !has_buttons) {
+			/* TBD:Improve joystick detection */
+			if (bit_is_set(key_bits, BTN_JOYSTICK))
+				return (IT_JOYSTICK);
+			else
+				has_buttons = true;
+		}
+
+		if (bit_is_set(abs_bits, ABS_X) &&
+		    bit_is_set(abs_bits, ABS_Y)) {
+			if (bit_is_set(key_bits, BTN_TOOL_PEN) ||
+			    bit_is_set(key_bits, BTN_STYLUS) ||
+			    bit_is_set(key_bits, BTN_STYLUS2)) {
+				return (IT_TABLET);
+			} else if (bit_is_set(abs_bits, ABS_PRESSURE) ||
+			           bit_is_set(key_bits, BTN_TOUCH)) {
+				if (has_lmr ||
+				    bit_is_set(key_bits, BTN_TOOL_FINGER))
+					return (IT_TOUCHPAD);
+				else
+					return (IT_TOUCHSCREEN);
+			} else if (!(bit_is_set(rel_bits, REL_X) &&
+			             bit_is_set(rel_bits, REL_Y)) &&
+			             has_lmr) {
+				/* some touchscreens use BTN_LEFT rather than BTN_TOUCH */
+				return (IT_TOUCHSCREEN);
+			}
+		}
+	}
+
+	if (has_keys)
+		return (IT_KEYBOARD);
+	else if (has_rel_axes || has_abs_axes || has_buttons)
+		return (IT_MOUSE);
+
+	return (IT_NONE);
+}
+
+/*
+ * Formats bitmap like kernel does for uevent: hex words from the most
+ * significant non-zero one down to word 0, separated by spaces.
+ */
+static void
+bits_format(const unsigned long *array, size_t nlongs, char *buf, size_t len)
+{
+	size_t off = 0;
+	int i;
+
+	for (i = nlongs - 1; i > 0; i--)
+		if (array[i] != 0)
+			break;
+
+	for (; i >= 0 && off < len; i--)
+		off += snprintf(buf + off, len - off, "%lx%s", array[i],
+		    i > 0 ? " " : "");
+}
+
+/* Exports capability bitmaps as EV=, KEY=, REL=, ABS=, MSC= and SW= */
+void
+evdev_caps_set_props(const struct evdev_caps *caps, struct udev_list *props)
+{
+	char buf[NLONGS(KEY_CNT) * (LONG_BITS / 4 + 1) + 1];
+
+	bits_format(caps->ev_bits, nitems(caps->ev_bits), buf, sizeof(buf));
+	udev_list_insert(props, "EV", buf);
+	if (bit_is_set(caps->ev_bits, EV_KEY)) {
+		bits_format(caps->key_bits, nitems(caps->key_bits), buf,
+		    sizeof(buf));
+		udev_list_insert(props, "KEY", buf);
+	}
+	if (bit_is_set(caps->ev_bits, EV_REL)) {
+		bits_format(caps->rel_bits, nitems(caps->rel_bits), buf,
+		    sizeof(buf));
+		udev_list_insert(props, "REL", buf);
+	}
+	if (bit_is_set(caps->ev_bits, EV_ABS)) {
+		bits_format(caps->abs_bits, nitems(caps->abs_bits), buf,
+		    sizeof(buf));
+		udev_list_insert(props, "ABS", buf);
+	}
+	if (bit_is_set(caps->ev_bits, EV_MSC)) {
+		bits_format(caps->msc_bits, nitems(caps->msc_bits), buf,
+		    sizeof(buf));
+		udev_list_insert(props, "MSC", buf);
+	}
+	if (bit_is_set(caps->ev_bits, EV_SW)) {
+		bits_format(caps->sw_bits, nitems(caps->sw_bits), buf,
+		    sizeof(buf));
+		udev_list_insert(props, "SW", buf);
+	}
+}
+
+#endif /* HAVE_LINUX_INPUT_H */
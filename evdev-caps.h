@@ -0,0 +1,38 @@
+#ifndef EVDEV_CAPS_H_
+#define EVDEV_CAPS_H_
+
+#ifdef HAVE_LINUX_INPUT_H
+
+#include <linux/input.h>
+
+#include <stdbool.h>
+
+#include "udev-list.h"
+
+#define	LONG_BITS	(sizeof(long) * 8)
+#define	NLONGS(x)	(((x) + LONG_BITS - 1) / LONG_BITS)
+
+/* Capability bitmaps as returned by EVIOCGBIT ioctls */
+struct evdev_caps {
+	unsigned long ev_bits[NLONGS(EV_CNT)];
+	unsigned long key_bits[NLONGS(KEY_CNT)];
+	unsigned long rel_bits[NLONGS(REL_CNT)];
+	unsigned long abs_bits[NLONGS(ABS_CNT)];
+	unsigned long msc_bits[NLONGS(MSC_CNT)];
+	unsigned long sw_bits[NLONGS(SW_CNT)];
+};
+
+static inline bool
+bit_is_set(const unsigned long *array, int bit)
+{
+	return !!(array[bit / LONG_BITS] & (1UL << (bit % LONG_BITS)));
+}
+
+bool bit_find(const unsigned long *array, int start, int stop);
+int evdev_caps_classify(const struct evdev_caps *caps);
+void evdev_caps_set_props(const struct evdev_caps *caps,
+    struct udev_list *props);
+
+#endif /* HAVE_LINUX_INPUT_H */
+
+#endif /* EVDEV_CAPS_H_ */
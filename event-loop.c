@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) 2015 Vladimir Kondratyev <wulf@cicgroup.ru>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "config.h"
+#include "event-loop.h"
+
+#include <sys/types.h>
+#ifdef HAVE_SYS_EVENT_H
+#include <sys/event.h>
+#else
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#endif
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_EVENT_H
+
+#define	EVENT_LOOP_USER_IDENT	1
+#define	EVENT_LOOP_TIMER_IDENT	1
+
+int
+event_loop_init(struct event_loop *el)
+{
+	struct kevent ke;
+
+	el->fd = kqueue();
+	if (el->fd < 0)
+		return (-1);
+
+	EV_SET(&ke, EVENT_LOOP_USER_IDENT, EVFILT_USER,
+	    EV_ADD | EV_ENABLE | EV_CLEAR, 0, 0, 0);
+	if (kevent(el->fd, &ke, 1, NULL, 0, NULL) < 0) {
+		close(el->fd);
+		el->fd = -1;
+		return (-1);
+	}
+
+	return (0);
+}
+
+void
+event_loop_close(struct event_loop *el)
+{
+
+	if (el->fd >= 0)
+		close(el->fd);
+	el->fd = -1;
+}
+
+int
+event_loop_add_read(struct event_loop *el, int fd)
+{
+	struct kevent ke;
+
+	EV_SET(&ke, fd, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, 0);
+	return (kevent(el->fd, &ke, 1, NULL, 0, NULL));
+}
+
+int
+event_loop_set_timer(struct event_loop *el, int msec)
+{
+	struct kevent ke;
+
+	EV_SET(&ke, EVENT_LOOP_TIMER_IDENT, EVFILT_TIMER,
+	    EV_ADD | EV_ENABLE | EV_ONESHOT, 0, msec, 0);
+	return (kevent(el->fd, &ke, 1, NULL, 0, NULL));
+}
+
+int
+event_loop_wakeup(struct event_loop *el)
+{
+	struct kevent ke;
+
+	EV_SET(&ke, EVENT_LOOP_USER_IDENT, EVFILT_USER, 0, NOTE_TRIGGER, 0, 0);
+	return (kevent(el->fd, &ke, 1, NULL, 0, NULL));
+}
+
+/*
+ * Waits up to timeout milliseconds (forever if negative) for some events to
+ * arrive. Returns number of events or -1
+ */
+int
+event_loop_wait(struct event_loop *el, struct event_loop_event *events,
+    int nevents, int timeout)
+{
+	struct kevent ke[EVENT_LOOP_MAX_EVENTS];
+	struct timespec ts;
+	int i, n, ret;
+
+	if (nevents > EVENT_LOOP_MAX_EVENTS)
+		nevents = EVENT_LOOP_MAX_EVENTS;
+
+	ts.tv_sec = timeout / 1000;
+	ts.tv_nsec = (timeout % 1000) * 1000000;
+	ret = kevent(el->fd, NULL, 0, ke, nevents, timeout < 0 ? NULL : &ts);
+	if (ret < 0)
+		return (-1);
+
+	for (i = 0, n = 0; i < ret; i++) {
+		switch (ke[i].filter) {
+		case EVFILT_READ:
+			events[n].type = EVENT_LOOP_READ;
+			events[n].fd = ke[i].ident;
+			events[n].data = ke[i].data;
+			events[n].eof = (ke[i].flags & EV_EOF) != 0;
+			break;
+		case EVFILT_TIMER:
+			events[n].type = EVENT_LOOP_TIMER;
+			events[n].fd = -1;
+			events[n].data = -1;
+			events[n].eof = false;
+			break;
+		case EVFILT_USER:
+			events[n].type = EVENT_LOOP_WAKEUP;
+			events[n].fd = -1;
+			events[n].data = -1;
+			events[n].eof = false;
+			break;
+		default:
+			continue;
+		}
+		n++;
+	}
+
+	return (n);
+}
+
+#else /* !HAVE_SYS_EVENT_H */
+
+int
+event_loop_init(struct event_loop *el)
+{
+	struct epoll_event ee;
+
+	el->timer_fd = -1;
+	el->wakeup_fd = -1;
+	el->fd = epoll_create1(EPOLL_CLOEXEC);
+	if (el->fd < 0)
+		return (-1);
+
+	el->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+	    TFD_NONBLOCK | TFD_CLOEXEC);
+	el->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (el->timer_fd < 0 || el->wakeup_fd < 0)
+		goto error;
+
+	memset(&ee, 0, sizeof(ee));
+	ee.events = EPOLLIN;
+	ee.data.fd = el->timer_fd;
+	if (epoll_ctl(el->fd, EPOLL_CTL_ADD, el->timer_fd, &ee) < 0)
+		goto error;
+	ee.data.fd = el->wakeup_fd;
+	if (epoll_ctl(el->fd, EPOLL_CTL_ADD, el->wakeup_fd, &ee) < 0)
+		goto error;
+
+	return (0);
+error:
+	event_loop_close(el);
+	return (-1);
+}
+
+void
+event_loop_close(struct event_loop *el)
+{
+
+	if (el->wakeup_fd >= 0)
+		close(el->wakeup_fd);
+	if (el->timer_fd >= 0)
+		close(el->timer_fd);
+	if (el->fd >= 0)
+		close(el->fd);
+	el->wakeup_fd = -1;
+	el->timer_fd = -1;
+	el->fd = -1;
+}
+
+int
+event_loop_add_read(struct event_loop *el, int fd)
+{
+	struct epoll_event ee;
+
+	memset(&ee, 0, sizeof(ee));
+	ee.events = EPOLLIN | EPOLLRDHUP;
+	ee.data.fd = fd;
+	return (epoll_ctl(el->fd, EPOLL_CTL_ADD, fd, &ee));
+}
+
+int
+event_loop_set_timer(struct event_loop *el, int msec)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = msec / 1000;
+	its.it_value.tv_nsec = (msec % 1000) * 1000000;
+	return (timerfd_settime(el->timer_fd, 0, &its, NULL));
+}
+
+int
+event_loop_wakeup(struct event_loop *el)
+{
+	uint64_t one = 1;
+
+	if (write(el->wakeup_fd, &one, sizeof(one)) != sizeof(one))
+		return (-1);
+	return (0);
+}
+
+/*
+ * Rearms level-triggered descriptor. Nothing to read is not an error:
+ * another wakeup may have consumed the counter already
+ */
+static int
+event_loop_drain(int fd)
+{
+	uint64_t count;
+
+	if (read(fd, &count, sizeof(count)) < 0 &&
+	    errno != EAGAIN && errno != EINTR)
+		return (-1);
+	return (0);
+}
+
+/*
+ * Waits up to timeout milliseconds (forever if negative) for some events to
+ * arrive. Returns number of events or -1
+ */
+int
+event_loop_wait(struct event_loop *el, struct event_loop_event *events,
+    int nevents, int timeout)
+{
+	struct epoll_event ee[EVENT_LOOP_MAX_EVENTS];
+	int i, ret;
+
+	if (nevents > EVENT_LOOP_MAX_EVENTS)
+		nevents = EVENT_LOOP_MAX_EVENTS;
+
+	ret = epoll_wait(el->fd, ee, nevents, timeout);
+	if (ret < 0)
+		return (-1);
+
+	for (i = 0; i < ret; i++) {
+		events[i].fd = -1;
+		events[i].data = -1;
+		events[i].eof = false;
+		if (ee[i].data.fd == el->timer_fd) {
+			if (event_loop_drain(el->timer_fd) < 0)
+				return (-1);
+			events[i].type = EVENT_LOOP_TIMER;
+		} else if (ee[i].data.fd == el->wakeup_fd) {
+			if (event_loop_drain(el->wakeup_fd) < 0)
+				return (-1);
+			events[i].type = EVENT_LOOP_WAKEUP;
+		} else {
+			events[i].type = EVENT_LOOP_READ;
+			events[i].fd = ee[i].data.fd;
+			events[i].eof = (ee[i].events &
+			    (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) != 0;
+		}
+	}
+
+	return (ret);
+}
+
+#endif /* HAVE_SYS_EVENT_H */
@@ -0,0 +1,44 @@
+#ifndef EVENT_LOOP_H_
+#define EVENT_LOOP_H_
+
+#include <sys/types.h>
+
+#include <stdbool.h>
+
+/* Upper limit of events harvested by single event_loop_wait() call */
+#define	EVENT_LOOP_MAX_EVENTS	16
+
+enum {
+	EVENT_LOOP_READ,	/* fd is readable */
+	EVENT_LOOP_TIMER,	/* one-shot timer expired */
+	EVENT_LOOP_WAKEUP,	/* event_loop_wakeup() has been called */
+};
+
+struct event_loop_event {
+	int type;
+	int fd;
+	ssize_t data;	/* bytes available for reading or -1 if unknown */
+	bool eof;
+};
+
+/*
+ * Minimal event loop backend of monitor thread: kqueue(2) on BSD and
+ * epoll(7) with timerfd and eventfd on Linux. It never allocates memory.
+ */
+struct event_loop {
+	int fd;
+#ifndef HAVE_SYS_EVENT_H
+	int timer_fd;
+	int wakeup_fd;
+#endif
+};
+
+int event_loop_init(struct event_loop *el);
+void event_loop_close(struct event_loop *el);
+int event_loop_add_read(struct event_loop *el, int fd);
+int event_loop_set_timer(struct event_loop *el, int msec);
+int event_loop_wakeup(struct event_loop *el);
+int event_loop_wait(struct event_loop *el, struct event_loop_event *events,
+    int nevents, int timeout);
+
+#endif /* EVENT_LOOP_H_ */
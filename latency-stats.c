@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2015 Vladimir Kondratyev <wulf@cicgroup.ru>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "config.h"
+#include "latency-stats.h"
+#include "udev-utils.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef ENABLE_LATENCY_STATS
+/* Process-wide as dispatcher, probe workers and consumers all feed them */
+static _Atomic(unsigned long)
+    latency_hist[UDEV_LATENCY_STAGES][UDEV_LATENCY_BUCKETS];
+
+/* Bucket 0 holds 0us samples, bucket i holds [2^(i-1), 2^i) us ones */
+static int
+latency_bucket(uint64_t usec)
+{
+	int bucket;
+
+	if (usec == 0)
+		return (0);
+	bucket = 64 - __builtin_clzll(usec);
+	return (bucket < UDEV_LATENCY_BUCKETS ?
+	    bucket : UDEV_LATENCY_BUCKETS - 1);
+}
+
+void
+latency_record(int stage, uint64_t usec)
+{
+
+	atomic_fetch_add_explicit(&latency_hist[stage][latency_bucket(usec)],
+	    1, memory_order_relaxed);
+}
+#endif /* ENABLE_LATENCY_STATS */
+
+LIBUDEV_EXPORT int
+udev_get_latency_stats(struct udev_latency_stats *stats)
+{
+#ifdef ENABLE_LATENCY_STATS
+	int i, j;
+
+	TRC("(%p)", stats);
+	for (i = 0; i < UDEV_LATENCY_STAGES; i++)
+		for (j = 0; j < UDEV_LATENCY_BUCKETS; j++)
+			stats->count[i][j] = atomic_load_explicit(
+			    &latency_hist[i][j], memory_order_relaxed);
+	return (0);
+#else
+	TRC("(%p)", stats);
+	memset(stats, 0, sizeof(*stats));
+	errno = ENOTSUP;
+	return (-1);
+#endif
+}
+
+LIBUDEV_EXPORT void
+udev_reset_latency_stats(void)
+{
+#ifdef ENABLE_LATENCY_STATS
+	int i, j;
+
+	TRC();
+	for (i = 0; i < UDEV_LATENCY_STAGES; i++)
+		for (j = 0; j < UDEV_LATENCY_BUCKETS; j++)
+			atomic_store_explicit(&latency_hist[i][j], 0,
+			    memory_order_relaxed);
+#else
+	TRC();
+#endif
+}
@@ -0,0 +1,24 @@
+#ifndef LATENCY_STATS_H_
+#define LATENCY_STATS_H_
+
+#include "libudev.h"
+#include "utils.h"
+
+#include <stdint.h>
+
+/*
+ * Monitor pipeline latency histograms. Without ENABLE_LATENCY_STATS macros
+ * expand to nothing so clock is never read.
+ */
+#ifdef ENABLE_LATENCY_STATS
+#define	LATENCY_NOW()			monotonic_usec()
+#define	LATENCY_RECORD(stage, start)					\
+	latency_record((stage), monotonic_usec() - (start))
+#else
+#define	LATENCY_NOW()			0
+#define	LATENCY_RECORD(stage, start)	do { (void)(start); } while (0)
+#endif
+
+void latency_record(int stage, uint64_t usec);
+
+#endif /* LATENCY_STATS_H_ */
@@ -101,13 +101,89 @@ void udev_monitor_unref(struct udev_monitor *udev_monitor);
 int udev_monitor_filter_add_match_subsystem_devtype(
     struct udev_monitor *udev_monitor, const char *subsystem,
     const char *devtype);
+int udev_monitor_filter_add_match_tag(struct udev_monitor *udev_monitor,
+    const char *tag);
+int udev_monitor_filter_update(struct udev_monitor *udev_monitor);
+int udev_monitor_filter_remove(struct udev_monitor *udev_monitor);
 int udev_monitor_enable_receiving(struct udev_monitor *udev_monitor);
 int udev_monitor_get_fd(struct udev_monitor *udev_monitor);
 struct udev_device *udev_monitor_receive_device(
     struct udev_monitor *udev_monitor);
+int udev_monitor_set_receive_buffer_size(struct udev_monitor *udev_monitor,
+    int size);
 const char *udev_device_get_action(struct udev_device *udev_device);
 struct udev *udev_monitor_get_udev(struct udev_monitor *udev_monitor);
 
+/* libudev-devd extensions */
+int udev_set_dev_path(struct udev *udev, const char *path);
+const char *udev_get_devd_socket(struct udev *udev);
+int udev_set_devd_socket(struct udev *udev, const char *path);
+int udev_device_revalidate(struct udev_device *udev_device);
+int udev_device_get_event_timestamps(struct udev_device *udev_device,
+    unsigned long long *read_usec, unsigned long long *probed_usec,
+    unsigned long long *dequeued_usec);
+int udev_register_fd(struct udev *udev, int fd);
+void udev_unregister_fd(struct udev *udev, int fd);
+int udev_monitor_set_inline(struct udev_monitor *udev_monitor, int enable);
+struct udev_device *udev_monitor_receive_device_timeout(
+    struct udev_monitor *udev_monitor, int timeout);
+
+/* What a monitor does with new event when its queue is full */
+enum {
+	UDEV_MONITOR_QUEUE_BLOCK,	/* hold devd events back */
+	UDEV_MONITOR_QUEUE_DROP_OLDEST,	/* drop head of the queue */
+	UDEV_MONITOR_QUEUE_COALESCE,	/* replace event of same syspath */
+};
+int udev_monitor_set_queue_limit(struct udev_monitor *udev_monitor,
+    size_t capacity, int policy);
+unsigned long udev_monitor_get_dropped(struct udev_monitor *udev_monitor);
+unsigned long udev_monitor_get_coalesced(
+    struct udev_monitor *udev_monitor);
+size_t udev_monitor_get_queue_high_water(struct udev_monitor *udev_monitor);
+int udev_monitor_set_coalesce_window(struct udev_monitor *udev_monitor,
+    unsigned int msec);
+unsigned long udev_monitor_get_folded(struct udev_monitor *udev_monitor);
+
+/* Probe pool of the devd dispatcher shared by threaded monitors */
+struct udev_monitor_probe_stats {
+	size_t queue_depth;		/* events waiting for a worker */
+	size_t queue_high_water;
+	unsigned long probes;		/* events handled by workers */
+	unsigned long latency_avg_usec;
+	unsigned long latency_max_usec;
+};
+int udev_monitor_get_probe_stats(struct udev_monitor *udev_monitor,
+    struct udev_monitor_probe_stats *stats);
+
+/* devd connection serving the monitor: dispatcher or inline one */
+struct udev_monitor_dispatch_stats {
+	unsigned long loop_iterations;	/* event loop wakeups */
+	unsigned long events;		/* devd messages parsed */
+};
+int udev_monitor_get_dispatch_stats(struct udev_monitor *udev_monitor,
+    struct udev_monitor_dispatch_stats *stats);
+
+/*
+ * Process-wide monitor pipeline latency histograms. Available only when
+ * built with --enable-latency-stats. Bucket 0 counts 0us samples, bucket i
+ * counts samples in [2^(i-1), 2^i) us, the last one also counts longer ones.
+ */
+#define	UDEV_LATENCY_BUCKETS	32
+enum {
+	UDEV_LATENCY_READ,	/* devd socket read(2) */
+	UDEV_LATENCY_PARSE,	/* devd message parsing */
+	UDEV_LATENCY_FILTER,	/* monitor filter matching */
+	UDEV_LATENCY_PROBE,	/* device creation and probing */
+	UDEV_LATENCY_QUEUE,	/* wait in monitor queue */
+	UDEV_LATENCY_DEQUEUE,	/* udev_monitor_receive_device() */
+	UDEV_LATENCY_STAGES,
+};
+struct udev_latency_stats {
+	unsigned long count[UDEV_LATENCY_STAGES][UDEV_LATENCY_BUCKETS];
+};
+int udev_get_latency_stats(struct udev_latency_stats *stats);
+void udev_reset_latency_stats(void);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
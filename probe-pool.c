@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) 2015 Vladimir Kondratyev <wulf@cicgroup.ru>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Worker pool running device probes off the devd dispatcher thread. Jobs
+ * sharing a syspath are never run concurrently and start in submission
+ * order, so per-device event order is preserved while a slow device does
+ * not hold back unrelated ones.
+ */
+
+#include "config.h"
+#include "probe-pool.h"
+#include "utils.h"
+
+#include <sys/types.h>
+#include <sys/queue.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define	PROBE_POOL_MAX_WORKERS	8
+
+struct probe_job {
+	STAILQ_ENTRY(probe_job) next;
+	void *owner;
+	struct probe_event ev;
+	char syspath[];
+};
+
+STAILQ_HEAD(probe_job_head, probe_job);
+
+struct probe_pool {
+	pthread_mutex_t mtx;
+	pthread_cond_t job_cv;	/* new job is runnable or pool is stopping */
+	pthread_cond_t done_cv;	/* some job has finished */
+	struct probe_job_head pending;
+	/* Jobs being run, indexed by worker */
+	struct probe_job *running[PROBE_POOL_MAX_WORKERS];
+	pthread_t workers[PROBE_POOL_MAX_WORKERS];
+	int nworkers;
+	bool stopping;
+	probe_pool_fn fn;
+	/* statistics */
+	size_t depth;
+	size_t depth_hwm;
+	unsigned long probes;
+	uint64_t latency_sum;
+	uint64_t latency_max;
+};
+
+struct probe_worker_arg {
+	struct probe_pool *pp;
+	int id;
+};
+
+/* Returns true if job of the same syspath is being run by some worker */
+static bool
+probe_pool_busy(struct probe_pool *pp, const char *syspath)
+{
+	int i;
+
+	for (i = 0; i < pp->nworkers; i++)
+		if (pp->running[i] != NULL &&
+		    strcmp(pp->running[i]->syspath, syspath) == 0)
+			return (true);
+	return (false);
+}
+
+/*
+ * Picks the oldest pending job whose syspath is not busy. Later jobs of
+ * skipped syspath stay behind it as they are checked against the same set.
+ */
+static struct probe_job *
+probe_pool_next(struct probe_pool *pp)
+{
+	struct probe_job *pj;
+
+	STAILQ_FOREACH(pj, &pp->pending, next) {
+		if (!probe_pool_busy(pp, pj->syspath)) {
+			STAILQ_REMOVE(&pp->pending, pj, probe_job, next);
+			pp->depth--;
+			return (pj);
+		}
+	}
+
+	return (NULL);
+}
+
+static void *
+probe_pool_worker(void *args)
+{
+	struct probe_worker_arg *pwa = args;
+	struct probe_pool *pp = pwa->pp;
+	struct probe_job *pj;
+	uint64_t start, latency;
+	int id = pwa->id;
+	sigset_t set;
+
+	free(pwa);
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	pthread_mutex_lock(&pp->mtx);
+	for (;;) {
+		while (!pp->stopping && (pj = probe_pool_next(pp)) == NULL)
+			pthread_cond_wait(&pp->job_cv, &pp->mtx);
+		if (pp->stopping)
+			break;
+		pp->running[id] = pj;
+		pthread_mutex_unlock(&pp->mtx);
+
+		start = monotonic_usec();
+		pp->fn(pj->owner, pj->syspath, &pj->ev);
+		latency = monotonic_usec() - start;
+
+		pthread_mutex_lock(&pp->mtx);
+		pp->running[id] = NULL;
+		pp->probes++;
+		pp->latency_sum += latency;
+		if (latency > pp->latency_max)
+			pp->latency_max = latency;
+		free(pj);
+		/* Jobs queued behind finished one may be runnable now */
+		pthread_cond_broadcast(&pp->job_cv);
+		pthread_cond_broadcast(&pp->done_cv);
+	}
+	pthread_mutex_unlock(&pp->mtx);
+
+	return (NULL);
+}
+
+struct probe_pool *
+probe_pool_new(int nworkers, probe_pool_fn fn)
+{
+	struct probe_pool *pp;
+	struct probe_worker_arg *pwa;
+
+	if (nworkers < 1)
+		nworkers = 1;
+	if (nworkers > PROBE_POOL_MAX_WORKERS)
+		nworkers = PROBE_POOL_MAX_WORKERS;
+
+	pp = calloc(1, sizeof(struct probe_pool));
+	if (pp == NULL)
+		return (NULL);
+
+	pthread_mutex_init(&pp->mtx, NULL);
+	pthread_cond_init(&pp->job_cv, NULL);
+	pthread_cond_init(&pp->done_cv, NULL);
+	STAILQ_INIT(&pp->pending);
+	pp->fn = fn;
+
+	for (pp->nworkers = 0; pp->nworkers < nworkers; pp->nworkers++) {
+		pwa = malloc(sizeof(struct probe_worker_arg));
+		if (pwa == NULL)
+			break;
+		pwa->pp = pp;
+		pwa->id = pp->nworkers;
+		if (pthread_create(&pp->workers[pp->nworkers], NULL,
+		    probe_pool_worker, pwa) != 0) {
+			free(pwa);
+			break;
+		}
+	}
+
+	if (pp->nworkers == 0) {
+		ERR("thread_create failed");
+		probe_pool_free(pp);
+		return (NULL);
+	}
+
+	return (pp);
+}
+
+void
+probe_pool_free(struct probe_pool *pp)
+{
+	struct probe_job *pj;
+	int i;
+
+	pthread_mutex_lock(&pp->mtx);
+	pp->stopping = true;
+	pthread_cond_broadcast(&pp->job_cv);
+	pthread_mutex_unlock(&pp->mtx);
+
+	for (i = 0; i < pp->nworkers; i++)
+		pthread_join(pp->workers[i], NULL);
+
+	while (!STAILQ_EMPTY(&pp->pending)) {
+		pj = STAILQ_FIRST(&pp->pending);
+		STAILQ_REMOVE_HEAD(&pp->pending, next);
+		free(pj);
+	}
+	pthread_cond_destroy(&pp->done_cv);
+	pthread_cond_destroy(&pp->job_cv);
+	pthread_mutex_destroy(&pp->mtx);
+	free(pp);
+}
+
+int
+probe_pool_submit(struct probe_pool *pp, void *owner, const char *syspath,
+    const struct probe_event *ev)
+{
+	struct probe_job *pj;
+
+	pj = malloc(offsetof(struct probe_job, syspath) + strlen(syspath) + 1);
+	if (pj == NULL)
+		return (-1);
+	pj->owner = owner;
+	pj->ev = *ev;
+	strcpy(pj->syspath, syspath);
+
+	pthread_mutex_lock(&pp->mtx);
+	STAILQ_INSERT_TAIL(&pp->pending, pj, next);
+	if (++pp->depth > pp->depth_hwm)
+		pp->depth_hwm = pp->depth;
+	pthread_cond_signal(&pp->job_cv);
+	pthread_mutex_unlock(&pp->mtx);
+
+	return (0);
+}
+
+/* Drops pending jobs of the owner and waits for its running ones */
+void
+probe_pool_cancel(struct probe_pool *pp, void *owner)
+{
+	struct probe_job *pj, *tmp;
+	bool running;
+	int i;
+
+	pthread_mutex_lock(&pp->mtx);
+	STAILQ_FOREACH_SAFE(pj, &pp->pending, next, tmp) {
+		if (pj->owner == owner) {
+			STAILQ_REMOVE(&pp->pending, pj, probe_job, next);
+			pp->depth--;
+			free(pj);
+		}
+	}
+
+	do {
+		running = false;
+		for (i = 0; i < pp->nworkers; i++)
+			if (pp->running[i] != NULL &&
+			    pp->running[i]->owner == owner)
+				running = true;
+		if (running)
+			pthread_cond_wait(&pp->done_cv, &pp->mtx);
+	} while (running);
+	pthread_mutex_unlock(&pp->mtx);
+}
+
+void
+probe_pool_get_stats(struct probe_pool *pp,
+    struct udev_monitor_probe_stats *stats)
+{
+
+	pthread_mutex_lock(&pp->mtx);
+	stats->queue_depth = pp->depth;
+	stats->queue_high_water = pp->depth_hwm;
+	stats->probes = pp->probes;
+	stats->latency_avg_usec = pp->probes > 0 ?
+	    pp->latency_sum / pp->probes : 0;
+	stats->latency_max_usec = pp->latency_max;
+	pthread_mutex_unlock(&pp->mtx);
+}
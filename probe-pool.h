@@ -0,0 +1,29 @@
+#ifndef PROBE_POOL_H_
+#define PROBE_POOL_H_
+
+#include "libudev.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct probe_pool;
+
+/* devd event to be probed */
+struct probe_event {
+	int action;
+	unsigned long long seqnum;
+	uint64_t read_usec;	/* when devd message has been read */
+};
+
+typedef void (*probe_pool_fn)(void *owner, const char *syspath,
+    const struct probe_event *ev);
+
+struct probe_pool *probe_pool_new(int nworkers, probe_pool_fn fn);
+void probe_pool_free(struct probe_pool *pp);
+int probe_pool_submit(struct probe_pool *pp, void *owner,
+    const char *syspath, const struct probe_event *ev);
+void probe_pool_cancel(struct probe_pool *pp, void *owner);
+void probe_pool_get_stats(struct probe_pool *pp,
+    struct udev_monitor_probe_stats *stats);
+
+#endif /* PROBE_POOL_H_ */
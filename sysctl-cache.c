@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2015 Vladimir Kondratyev <wulf@cicgroup.ru>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "config.h"
+#include "sysctl-cache.h"
+#include "utils.h"
+
+#include <sys/types.h>
+#ifdef HAVE_SYS_SYSCTL_H
+#include <sys/sysctl.h>
+#endif
+#include <sys/tree.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef CTL_MAXNAME
+#define	CTL_MAXNAME	24
+#endif
+
+/*
+ * sysctlbyname() makes kernel translate the name to MIB on every call.
+ * Translations are cached here keyed by name, so names of one device class
+ * (dev.ukbd.*) are adjacent in the tree and can be dropped together.
+ */
+struct sysctl_cache_entry {
+	RB_ENTRY(sysctl_cache_entry) link;
+	u_int miblen;
+	int mib[CTL_MAXNAME];
+	char name[];
+};
+
+RB_HEAD(sysctl_cache_tree, sysctl_cache_entry);
+
+static int
+sysctl_cache_entry_cmp(struct sysctl_cache_entry *sce1,
+    struct sysctl_cache_entry *sce2)
+{
+
+	return (strcmp(sce1->name, sce2->name));
+}
+
+RB_GENERATE_STATIC(sysctl_cache_tree, sysctl_cache_entry, link,
+    sysctl_cache_entry_cmp);
+
+#ifdef HAVE_SYS_SYSCTL_H
+static int
+kernel_sysctl_get(const int *mib, u_int miblen, void *oldp, size_t *oldlenp)
+{
+
+	return (sysctl(mib, miblen, oldp, oldlenp, NULL, 0));
+}
+
+static const struct sysctl_ops kernel_sysctl_ops = {
+	.nametomib = sysctlnametomib,
+	.get = kernel_sysctl_get,
+};
+#else
+static int
+nosysctl_nametomib(const char *name __unused, int *mibp __unused,
+    size_t *sizep __unused)
+{
+
+	errno = ENOENT;
+	return (-1);
+}
+
+static int
+nosysctl_get(const int *mib __unused, u_int miblen __unused,
+    void *oldp __unused, size_t *oldlenp __unused)
+{
+
+	errno = ENOENT;
+	return (-1);
+}
+
+static const struct sysctl_ops kernel_sysctl_ops = {
+	.nametomib = nosysctl_nametomib,
+	.get = nosysctl_get,
+};
+#endif /* HAVE_SYS_SYSCTL_H */
+
+static pthread_mutex_t sysctl_cache_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct sysctl_cache_tree sysctl_cache = RB_INITIALIZER(&sysctl_cache);
+static const struct sysctl_ops *sysctl_ops = &kernel_sysctl_ops;
+
+/* Replaces sysctl backend. NULL restores kernel one. Drops the cache */
+void
+sysctl_cache_set_ops(const struct sysctl_ops *ops)
+{
+
+	sysctl_cache_invalidate("");
+	pthread_mutex_lock(&sysctl_cache_mtx);
+	sysctl_ops = ops != NULL ? ops : &kernel_sysctl_ops;
+	pthread_mutex_unlock(&sysctl_cache_mtx);
+}
+
+static struct sysctl_cache_entry *
+sysctl_cache_entry_new(const char *name)
+{
+	struct sysctl_cache_entry *sce;
+
+	sce = calloc(1, offsetof(struct sysctl_cache_entry, name) +
+	    strlen(name) + 1);
+	if (sce != NULL)
+		strcpy(sce->name, name);
+	return (sce);
+}
+
+/* Drops cached translations of all names starting with prefix */
+void
+sysctl_cache_invalidate(const char *prefix)
+{
+	struct sysctl_cache_entry *key, *sce1, *sce2;
+	size_t prefixlen;
+
+	key = sysctl_cache_entry_new(prefix);
+	if (key == NULL)
+		return;
+	prefixlen = strlen(prefix);
+
+	pthread_mutex_lock(&sysctl_cache_mtx);
+	for (sce1 = RB_NFIND(sysctl_cache_tree, &sysctl_cache, key);
+	     sce1 != NULL && strncmp(sce1->name, prefix, prefixlen) == 0;
+	     sce1 = sce2) {
+		sce2 = RB_NEXT(sysctl_cache_tree, &sysctl_cache, sce1);
+		RB_REMOVE(sysctl_cache_tree, &sysctl_cache, sce1);
+		free(sce1);
+	}
+	pthread_mutex_unlock(&sysctl_cache_mtx);
+	free(key);
+}
+
+/* sysctlbyname() equivalent with cached name to MIB translation */
+int
+sysctl_cache_get(const char *name, void *buf, size_t *len)
+{
+	struct sysctl_cache_entry *key, *sce, *old_sce;
+	const struct sysctl_ops *ops;
+	int mib[CTL_MAXNAME];
+	size_t miblen = 0;
+
+	key = sysctl_cache_entry_new(name);
+	if (key == NULL)
+		return (-1);
+
+	pthread_mutex_lock(&sysctl_cache_mtx);
+	ops = sysctl_ops;
+	sce = RB_FIND(sysctl_cache_tree, &sysctl_cache, key);
+	if (sce != NULL) {
+		miblen = sce->miblen;
+		memcpy(mib, sce->mib, miblen * sizeof(int));
+	}
+	pthread_mutex_unlock(&sysctl_cache_mtx);
+
+	if (miblen != 0) {
+		if (ops->get(mib, miblen, buf, len) == 0) {
+			free(key);
+			return (0);
+		}
+		/* Device detached. Its OID can be reused by other one */
+		if (errno != ENOENT) {
+			free(key);
+			return (-1);
+		}
+		sysctl_cache_invalidate(name);
+	}
+
+	miblen = CTL_MAXNAME;
+	if (ops->nametomib(name, key->mib, &miblen) < 0) {
+		free(key);
+		return (-1);
+	}
+	key->miblen = miblen;
+	memcpy(mib, key->mib, miblen * sizeof(int));
+
+	pthread_mutex_lock(&sysctl_cache_mtx);
+	old_sce = RB_INSERT(sysctl_cache_tree, &sysctl_cache, key);
+	if (old_sce != NULL) {
+		RB_REMOVE(sysctl_cache_tree, &sysctl_cache, old_sce);
+		free(old_sce);
+		RB_INSERT(sysctl_cache_tree, &sysctl_cache, key);
+	}
+	pthread_mutex_unlock(&sysctl_cache_mtx);
+
+	return (ops->get(mib, miblen, buf, len));
+}
+
+/* Fetches string sysctl and makes sure it is zero-terminated */
+int
+sysctl_cache_get_string(const char *name, char *buf, size_t len)
+{
+
+	if (len == 0 || sysctl_cache_get(name, buf, &len) < 0)
+		return (-1);
+	buf[len < 1 ? 0 : len - 1] = '\0';
+	return (0);
+}
+
+/* Fetches %desc, %pnpinfo and %parent of newbus device at once */
+int
+sysctl_cache_get_newbus(const char *devname, const char *unit,
+    struct newbus_sysctls *ns)
+{
+	char name[64];
+	int off;
+
+	off = snprintf(name, sizeof(name), "dev.%s.%s.%%", devname, unit);
+	if (off < 0 || (size_t)off + sizeof("pnpinfo") > sizeof(name))
+		return (-1);
+
+	strcpy(name + off, "desc");
+	if (sysctl_cache_get_string(name, ns->desc, sizeof(ns->desc)) < 0)
+		return (-1);
+	strcpy(name + off, "pnpinfo");
+	if (sysctl_cache_get_string(name, ns->pnpinfo,
+	    sizeof(ns->pnpinfo)) < 0)
+		return (-1);
+	strcpy(name + off, "parent");
+	if (sysctl_cache_get_string(name, ns->parent,
+	    sizeof(ns->parent)) < 0)
+		return (-1);
+
+	return (0);
+}
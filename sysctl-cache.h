@@ -0,0 +1,28 @@
+#ifndef SYSCTL_CACHE_H_
+#define SYSCTL_CACHE_H_
+
+#include <sys/types.h>
+
+#include <stddef.h>
+
+/* Kernel sysctl backend. Can be replaced with test double */
+struct sysctl_ops {
+	int (*nametomib)(const char *name, int *mibp, size_t *sizep);
+	int (*get)(const int *mib, u_int miblen, void *oldp, size_t *oldlenp);
+};
+
+/* Newbus device data exported through dev.<driver>.<unit>.% sysctls */
+struct newbus_sysctls {
+	char desc[80];
+	char pnpinfo[1024];
+	char parent[80];
+};
+
+void sysctl_cache_set_ops(const struct sysctl_ops *ops);
+int sysctl_cache_get(const char *name, void *buf, size_t *len);
+int sysctl_cache_get_string(const char *name, char *buf, size_t len);
+int sysctl_cache_get_newbus(const char *devname, const char *unit,
+    struct newbus_sysctls *ns);
+void sysctl_cache_invalidate(const char *prefix);
+
+#endif /* SYSCTL_CACHE_H_ */
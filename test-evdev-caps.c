@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2015 Vladimir Kondratyev <wulf@cicgroup.ru>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Checks word-at-a-time bit_find() against bit-by-bit scan, feeds
+ * evdev_caps_classify() with synthetic bitmaps of common device kinds and
+ * compares exported capability strings with kernel uevent format.
+ * Exit status follows automake test conventions.
+ */
+
+#include "config.h"
+#include "evdev-caps.h"
+#include "udev-list.h"
+#include "udev-utils.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_LINUX_INPUT_H
+
+#define	CHECK(cond) do {						\
+	if (!(cond)) {							\
+		fprintf(stderr, "%s:%d: check failed: %s\n",		\
+		    __FILE__, __LINE__, #cond);				\
+		failures++;						\
+	}								\
+} while (0)
+
+/* Bitmap spanning several words, boundaries are tested on both sides */
+#define	TEST_BITS	(LONG_BITS * 4)
+
+static int failures;
+
+static void
+bit_set(unsigned long *array, int bit)
+{
+
+	array[bit / LONG_BITS] |= 1UL << (bit % LONG_BITS);
+}
+
+static void
+test_bit_find(void)
+{
+	unsigned long bits[NLONGS(TEST_BITS)];
+	int bit, start, stop;
+
+	/* Exactly one bit set: range has to hit it and nothing else */
+	for (bit = 0; bit < TEST_BITS; bit++) {
+		memset(bits, 0, sizeof(bits));
+		bit_set(bits, bit);
+		for (start = 0; start <= TEST_BITS; start++)
+			for (stop = start; stop <= TEST_BITS; stop++)
+				CHECK(bit_find(bits, start, stop) ==
+				    (start <= bit && bit < stop));
+	}
+
+	/* All bits set: any non-empty range is a hit */
+	memset(bits, 0xff, sizeof(bits));
+	for (start = 0; start <= TEST_BITS; start++)
+		for (stop = start; stop <= TEST_BITS; stop++)
+			CHECK(bit_find(bits, start, stop) == (start < stop));
+}
+
+static void
+caps_set(struct evdev_caps *caps, unsigned long *array, const int *bits)
+{
+
+	for (; *bits >= 0; bits++) {
+		bit_set(array, *bits);
+		if (array == caps->key_bits)
+			bit_set(caps->ev_bits, EV_KEY);
+		else if (array == caps->rel_bits)
+			bit_set(caps->ev_bits, EV_REL);
+		else if (array == caps->abs_bits)
+			bit_set(caps->ev_bits, EV_ABS);
+		else if (array == caps->sw_bits)
+			bit_set(caps->ev_bits, EV_SW);
+	}
+}
+
+struct classify_case {
+	const char *name;
+	int input_type;
+	int key[8];
+	int rel[4];
+	int abs[8];
+	int sw[4];
+};
+
+/* Every bit list is terminated by -1 */
+static const struct classify_case classify_cases[] = {
+	{ "empty", IT_NONE,
+	    { -1 }, { -1 }, { -1 }, { -1 } },
+	{ "keyboard", IT_KEYBOARD,
+	    { KEY_ESC, KEY_A, KEY_ENTER, -1 }, { -1 }, { -1 }, { -1 } },
+	{ "mouse", IT_MOUSE,
+	    { BTN_LEFT, BTN_RIGHT, BTN_MIDDLE, -1 },
+	    { REL_X, REL_Y, REL_WHEEL, -1 }, { -1 }, { -1 } },
+	{ "absolute mouse", IT_MOUSE,
+	    { BTN_LEFT, -1 }, { REL_X, REL_Y, -1 }, { ABS_X, ABS_Y, -1 },
+	    { -1 } },
+	{ "touchpad", IT_TOUCHPAD,
+	    { BTN_LEFT, BTN_TOOL_FINGER, BTN_TOUCH, -1 }, { -1 },
+	    { ABS_X, ABS_Y, ABS_PRESSURE, -1 }, { -1 } },
+	{ "clickpad", IT_TOUCHPAD,
+	    { BTN_TOOL_FINGER, BTN_TOUCH, -1 }, { -1 },
+	    { ABS_X, ABS_Y, ABS_MT_SLOT, ABS_MT_POSITION_X,
+	    ABS_MT_POSITION_Y, -1 }, { -1 } },
+	{ "tablet", IT_TABLET,
+	    { BTN_TOOL_PEN, BTN_STYLUS, BTN_TOUCH, -1 }, { -1 },
+	    { ABS_X, ABS_Y, ABS_PRESSURE, -1 }, { -1 } },
+	{ "touchscreen", IT_TOUCHSCREEN,
+	    { BTN_TOUCH, -1 }, { -1 }, { ABS_X, ABS_Y, -1 }, { -1 } },
+	{ "multitouch touchscreen", IT_TOUCHSCREEN,
+	    { BTN_TOUCH, -1 }, { -1 },
+	    { ABS_X, ABS_Y, ABS_MT_SLOT, ABS_MT_POSITION_X,
+	    ABS_MT_POSITION_Y, -1 }, { -1 } },
+	{ "BTN_LEFT touchscreen", IT_TOUCHSCREEN,
+	    { BTN_LEFT, -1 }, { -1 }, { ABS_X, ABS_Y, -1 }, { -1 } },
+	{ "joystick", IT_JOYSTICK,
+	    { BTN_TRIGGER, BTN_THUMB, -1 }, { -1 },
+	    { ABS_X, ABS_Y, ABS_RZ, ABS_HAT0X, ABS_MISC, ABS_MT_SLOT, -1 },
+	    { -1 } },
+	/* Switches alone are not classified as input device */
+	{ "lid switch", IT_NONE,
+	    { -1 }, { -1 }, { -1 }, { SW_LID, -1 } },
+	{ "keyboard with switch", IT_KEYBOARD,
+	    { KEY_SLEEP, -1 }, { -1 }, { -1 }, { SW_TABLET_MODE, -1 } },
+};
+
+static void
+test_classify(void)
+{
+	const struct classify_case *cc;
+	struct evdev_caps caps;
+	size_t i;
+	int input_type;
+
+	for (i = 0; i < sizeof(classify_cases) / sizeof(classify_cases[0]);
+	    i++) {
+		cc = &classify_cases[i];
+		memset(&caps, 0, sizeof(caps));
+		caps_set(&caps, caps.key_bits, cc->key);
+		caps_set(&caps, caps.rel_bits, cc->rel);
+		caps_set(&caps, caps.abs_bits, cc->abs);
+		caps_set(&caps, caps.sw_bits, cc->sw);
+		input_type = evdev_caps_classify(&caps);
+		if (input_type != cc->input_type) {
+			fprintf(stderr, "%s: classified as %d, expected %d\n",
+			    cc->name, input_type, cc->input_type);
+			failures++;
+		}
+	}
+}
+
+static void
+check_prop(struct udev_list *props, const char *name, const char *expected)
+{
+	struct udev_list_entry *ule;
+	const char *value;
+
+	ule = udev_list_find(props, name);
+	value = ule != NULL ? _udev_list_entry_get_value(ule) : NULL;
+	if (expected == NULL ? value != NULL :
+	    value == NULL || strcmp(value, expected) != 0) {
+		fprintf(stderr, "%s=%s, expected %s\n", name,
+		    value != NULL ? value : "(none)",
+		    expected != NULL ? expected : "(none)");
+		failures++;
+	}
+}
+
+static void
+test_set_props(void)
+{
+	static const int keys[] = { KEY_ESC, BTN_LEFT, -1 };
+	static const int rels[] = { REL_X, REL_Y, -1 };
+	static const int abss[] = { ABS_X, ABS_Y, ABS_MT_SLOT, -1 };
+	struct evdev_caps caps;
+	struct udev_list props;
+
+	/* No capabilities: single zero word, nothing but EV exported */
+	memset(&caps, 0, sizeof(caps));
+	udev_list_init(&props);
+	evdev_caps_set_props(&caps, &props);
+	check_prop(&props, "EV", "0");
+	check_prop(&props, "KEY", NULL);
+	check_prop(&props, "REL", NULL);
+	udev_list_free(&props);
+
+	/* Words are printed most significant first, leading zero ones cut */
+	memset(&caps, 0, sizeof(caps));
+	caps_set(&caps, caps.key_bits, keys);
+	caps_set(&caps, caps.rel_bits, rels);
+	caps_set(&caps, caps.abs_bits, abss);
+	udev_list_init(&props);
+	evdev_caps_set_props(&caps, &props);
+	check_prop(&props, "EV", "e");
+	check_prop(&props, "REL", "3");
+	if (LONG_BITS == 64) {
+		check_prop(&props, "KEY", "10000 0 0 0 2");
+		check_prop(&props, "ABS", "800000000003");
+	} else {
+		check_prop(&props, "KEY", "10000 0 0 0 0 0 0 0 2");
+		check_prop(&props, "ABS", "8000 3");
+	}
+	check_prop(&props, "MSC", NULL);
+	check_prop(&props, "SW", NULL);
+	udev_list_free(&props);
+}
+
+int
+main(void)
+{
+
+	test_bit_find();
+	test_classify();
+	test_set_props();
+	return (failures != 0);
+}
+
+#else /* !HAVE_LINUX_INPUT_H */
+
+int
+main(void)
+{
+
+	/* Skipped */
+	return (77);
+}
+
+#endif /* HAVE_LINUX_INPUT_H */
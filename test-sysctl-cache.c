@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2015 Vladimir Kondratyev <wulf@cicgroup.ru>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Exercises sysctl name to MIB cache over test double backend: cached
+ * translations, re-translation after OID reuse and prefix invalidation.
+ * Exit status follows automake test conventions.
+ */
+
+#include "config.h"
+#include "sysctl-cache.h"
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#define	CHECK(cond) do {						\
+	if (!(cond)) {							\
+		fprintf(stderr, "%s:%d: check failed: %s\n",		\
+		    __FILE__, __LINE__, #cond);				\
+		failures++;						\
+	}								\
+} while (0)
+
+struct fake_oid {
+	const char *name;
+	int oid;
+	const char *value;
+};
+
+static struct fake_oid fake_oids[] = {
+	{ "dev.ukbd.0.%desc",		1,	"Keyboard" },
+	{ "dev.ukbd.0.%pnpinfo",	2,	"vendor=0x046d product=0xc31c" },
+	{ "dev.ukbd.0.%parent",		3,	"uhub1" },
+	{ "dev.ukbd.1.%desc",		4,	"Second keyboard" },
+	{ "dev.ums.0.%desc",		5,	"Mouse" },
+};
+
+static int failures;
+static int next_oid = 100;
+static int nametomib_calls;
+static int get_calls;
+
+static struct fake_oid *
+fake_find(const char *name, int oid)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(fake_oids) / sizeof(fake_oids[0]); i++)
+		if (name != NULL ? strcmp(fake_oids[i].name, name) == 0 :
+		    fake_oids[i].oid == oid)
+			return (&fake_oids[i]);
+	return (NULL);
+}
+
+static int
+fake_nametomib(const char *name, int *mibp, size_t *sizep)
+{
+	struct fake_oid *fo;
+
+	nametomib_calls++;
+	fo = fake_find(name, 0);
+	if (fo == NULL || *sizep < 1) {
+		errno = ENOENT;
+		return (-1);
+	}
+	mibp[0] = fo->oid;
+	*sizep = 1;
+	return (0);
+}
+
+static int
+fake_get(const int *mib, u_int miblen, void *oldp, size_t *oldlenp)
+{
+	struct fake_oid *fo;
+	size_t len;
+
+	get_calls++;
+	fo = miblen == 1 ? fake_find(NULL, mib[0]) : NULL;
+	if (fo == NULL) {
+		errno = ENOENT;
+		return (-1);
+	}
+	len = strlen(fo->value) + 1;
+	if (len > *oldlenp) {
+		errno = ENOMEM;
+		return (-1);
+	}
+	memcpy(oldp, fo->value, len);
+	*oldlenp = len;
+	return (0);
+}
+
+static const struct sysctl_ops fake_ops = {
+	.nametomib = fake_nametomib,
+	.get = fake_get,
+};
+
+/* Detaches device owning the name. Newly attached one gets fresh OID */
+static void
+fake_reattach(const char *name, const char *value)
+{
+	struct fake_oid *fo;
+
+	fo = fake_find(name, 0);
+	fo->oid = next_oid++;
+	fo->value = value;
+}
+
+static void
+test_cached(void)
+{
+	char buf[80];
+
+	nametomib_calls = get_calls = 0;
+	CHECK(sysctl_cache_get_string("dev.ukbd.0.%desc", buf,
+	    sizeof(buf)) == 0);
+	CHECK(strcmp(buf, "Keyboard") == 0);
+	CHECK(sysctl_cache_get_string("dev.ukbd.0.%desc", buf,
+	    sizeof(buf)) == 0);
+	CHECK(strcmp(buf, "Keyboard") == 0);
+	CHECK(nametomib_calls == 1);
+	CHECK(get_calls == 2);
+
+	/* Failed translations are not cached */
+	errno = 0;
+	CHECK(sysctl_cache_get_string("dev.ukbd.9.%desc", buf,
+	    sizeof(buf)) == -1);
+	CHECK(errno == ENOENT);
+	CHECK(sysctl_cache_get_string("dev.ukbd.9.%desc", buf,
+	    sizeof(buf)) == -1);
+	CHECK(nametomib_calls == 3);
+}
+
+static void
+test_reused_oid(void)
+{
+	char buf[80];
+
+	CHECK(sysctl_cache_get_string("dev.ums.0.%desc", buf,
+	    sizeof(buf)) == 0);
+	fake_reattach("dev.ums.0.%desc", "Other mouse");
+
+	/* Stale MIB fails with ENOENT and name is translated again */
+	nametomib_calls = get_calls = 0;
+	CHECK(sysctl_cache_get_string("dev.ums.0.%desc", buf,
+	    sizeof(buf)) == 0);
+	CHECK(strcmp(buf, "Other mouse") == 0);
+	CHECK(nametomib_calls == 1);
+	CHECK(get_calls == 2);
+
+	nametomib_calls = get_calls = 0;
+	CHECK(sysctl_cache_get_string("dev.ums.0.%desc", buf,
+	    sizeof(buf)) == 0);
+	CHECK(nametomib_calls == 0);
+	CHECK(get_calls == 1);
+}
+
+static void
+test_invalidate(void)
+{
+	struct newbus_sysctls ns;
+	char buf[80];
+
+	CHECK(sysctl_cache_get_newbus("ukbd", "0", &ns) == 0);
+	CHECK(strcmp(ns.desc, "Keyboard") == 0);
+	CHECK(strcmp(ns.pnpinfo, "vendor=0x046d product=0xc31c") == 0);
+	CHECK(strcmp(ns.parent, "uhub1") == 0);
+	CHECK(sysctl_cache_get_string("dev.ukbd.1.%desc", buf,
+	    sizeof(buf)) == 0);
+	CHECK(sysctl_cache_get_string("dev.ums.0.%desc", buf,
+	    sizeof(buf)) == 0);
+
+	/* Only names of the detached device are translated again */
+	sysctl_cache_invalidate("dev.ukbd.0.");
+	nametomib_calls = 0;
+	CHECK(sysctl_cache_get_newbus("ukbd", "0", &ns) == 0);
+	CHECK(nametomib_calls == 3);
+	CHECK(sysctl_cache_get_string("dev.ukbd.1.%desc", buf,
+	    sizeof(buf)) == 0);
+	CHECK(strcmp(buf, "Second keyboard") == 0);
+	CHECK(sysctl_cache_get_string("dev.ums.0.%desc", buf,
+	    sizeof(buf)) == 0);
+	CHECK(nametomib_calls == 3);
+
+	/* Replacing backend drops everything */
+	sysctl_cache_set_ops(&fake_ops);
+	nametomib_calls = 0;
+	CHECK(sysctl_cache_get_string("dev.ums.0.%desc", buf,
+	    sizeof(buf)) == 0);
+	CHECK(nametomib_calls == 1);
+}
+
+int
+main(void)
+{
+
+	sysctl_cache_set_ops(&fake_ops);
+	test_cached();
+	test_reused_oid();
+	test_invalidate();
+	sysctl_cache_set_ops(NULL);
+	return (failures != 0);
+}
@@ -28,29 +28,50 @@
 #include "libudev.h"
 #include "udev.h"
 #include "udev-device.h"
+#include "evdev-caps.h"
 #include "udev-filter.h"
+#include "udev-index.h"
 #include "udev-list.h"
 #include "udev-utils.h"
+#include "sysctl-cache.h"
 #include "utils.h"
 
 #include <sys/types.h>
-#include <sys/sysctl.h>
 #include <sys/stat.h>
 
+#include <errno.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdatomic.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+/* Serializes lazy resolution of ancestor chains and capability export */
+static pthread_mutex_t parent_mtx = PTHREAD_MUTEX_INITIALIZER;
+
 struct udev_device {
 	_Atomic(int) refcount;
 	struct {
 		unsigned int action : 2;
-		unsigned int is_parent : 1;
+		unsigned int shared : 1;
+		unsigned int stat_cached : 1;
 	} flags;
+	/* evdev capabilities exported as properties on first request */
+	struct evdev_caps *evdev_caps;
+	_Atomic(bool) caps_exported;
+	/* devnode identity captured on first request */
+	dev_t devnum;
+	mode_t mode;
+	dev_t dev;
+	ino_t ino;
+	_Atomic(bool) parent_resolved;
+	/* monitor event sequence number and timestamps in microseconds */
+	unsigned long long seqnum;
+	uint64_t stamps[UD_STAMP_MAX];
 	struct udev_list prop_list;
 	struct udev_list sysattr_list;
 	struct udev_list tag_list;
@@ -68,44 +89,113 @@ udev_device_new_from_syspath(struct udev *udev, const char *syspath)
 	return (udev_device_new_common(udev, syspath, UD_ACTION_NONE));
 }
 
-LIBUDEV_EXPORT struct udev_device *
-udev_device_new_from_devnum(struct udev *udev, char type, dev_t devnum)
+/* Stats devnode of syspath. Fails if it is not a character device */
+static int
+devnode_stat(const char *syspath, struct stat *st)
+{
+	const char *devpath;
+
+	devpath = get_devpath_by_syspath(syspath);
+	if (devpath == NULL || stat(devpath, st) < 0 || !S_ISCHR(st->st_mode))
+		return (-1);
+	return (0);
+}
+
+/* Checks that indexed node has not been removed or renumbered */
+static bool
+devnode_matches(const char *syspath, dev_t devnum)
 {
-	char devpath[DEV_PATH_MAX] = DEV_PATH_ROOT "/";
-	char devbuf[32], buf[32], *devbufptr;
-	const char *syspath;
-	struct udev_device *device, *parent;
-	size_t dev_len;
 	struct stat st;
-	size_t buflen;
 
-	dev_len = strlen(devpath);
-	devname_r(devnum, S_IFCHR, devpath + dev_len, sizeof(devpath) - dev_len);
+	return (devnode_stat(syspath, &st) == 0 && st.st_rdev == devnum);
+}
 
-	/* Recheck path as devname_r returns zero-terminated garbage on error */
-	if (stat(devpath, &st) != 0 || st.st_rdev != devnum) {
-		TRC("(%d) -> failed", (int)devnum);
-		return NULL;
-	}
+/* Reads PCI_ID of device node, e.g. dev.drm.0.PCI_ID for /dev/drm/0 */
+static int
+get_pci_id_by_syspath(struct udev *udev, const char *syspath, char *pci_id,
+    size_t len)
+{
+	char devbuf[32], buf[48], *devbufptr;
+	const char *relpath;
+	int ret;
 
-	TRC("(%d) -> %s", (int)devnum, devpath);
-	syspath = get_syspath_by_devpath(devpath);
-	strncpy(devbuf, devpath + 1, 32);
+	relpath = get_relpath_by_syspath(udev, syspath);
+	if (relpath == NULL ||
+	    strlcpy(devbuf, relpath, sizeof(devbuf)) >= sizeof(devbuf))
+		return (-1);
 	devbufptr = devbuf;
 	devbufptr = strchrnul(devbufptr, '/');
 	while (*devbufptr != '\0') {
 		*devbufptr = '.';
 		devbufptr = strchrnul(devbufptr, '/');
 	}
-	snprintf(buf, 32, "%s.PCI_ID", devbuf);
-	buflen = 32;
+	ret = snprintf(buf, sizeof(buf), "dev.%s.PCI_ID", devbuf);
+	if (ret < 0 || (size_t)ret >= sizeof(buf))
+		return (-1);
 
-	sysctlbyname(buf, devbuf, &buflen, NULL, 0);
+	return (sysctl_cache_get(buf, pci_id, &len));
+}
+
+LIBUDEV_EXPORT struct udev_device *
+udev_device_new_from_devnum(struct udev *udev, char type, dev_t devnum)
+{
+	char devpath[DEV_PATH_MAX];
+	char syspath[SYS_PATH_MAX], pci_id[32];
+	struct udev_device *device, *parent;
+	struct udev_index *index;
+	unsigned long generation;
+	size_t dev_len;
+	struct stat st;
+
+	/*
+	 * Index is kept current by running monitors. Otherwise revalidate
+	 * cached entry with single stat() as devnums can be reused.
+	 */
+	index = udev_get_index(udev);
+	if (udev_index_find_devnum(index, devnum, syspath, sizeof(syspath)) &&
+	    (udev_index_is_tracked(index) || devnode_matches(syspath, devnum))) {
+		TRC("(%d) -> %s (cached)", (int)devnum, syspath);
+	} else {
+		/* Node found below could be removed before it is indexed */
+		generation = udev_index_get_generation(index);
+		dev_len = snprintf(devpath, sizeof(devpath), "%s/",
+		    udev_get_dev_path(udev));
+		if (dev_len >= sizeof(devpath))
+			return (NULL);
+		devname_r(devnum, S_IFCHR, devpath + dev_len,
+		    sizeof(devpath) - dev_len);
+
+		/*
+		 * Recheck path as devname_r returns zero-terminated garbage
+		 * on error
+		 */
+		if (stat(devpath, &st) != 0 || st.st_rdev != devnum) {
+			TRC("(%d) -> failed", (int)devnum);
+			return NULL;
+		}
+
+		TRC("(%d) -> %s", (int)devnum, devpath);
+		strlcpy(syspath, get_syspath_by_devpath(devpath),
+		    sizeof(syspath));
+		udev_index_add_since(index, syspath, devnum, generation);
+	}
 
 	device = udev_device_new_common(udev, syspath, UD_ACTION_NONE);
-	parent = udev_device_new_common(udev, syspath, UD_ACTION_NONE);
-	udev_list_insert(&parent->prop_list, "PCI_ID", devbuf);
-	udev_device_set_parent(device, parent);
+	if (device == NULL)
+		return (NULL);
+	parent = udev_parent_find(udev, syspath);
+	if (parent == NULL) {
+		parent = udev_device_new_parent(udev, syspath);
+		if (parent != NULL) {
+			if (get_pci_id_by_syspath(udev, syspath, pci_id,
+			    sizeof(pci_id)) == 0)
+				udev_list_insert(&parent->prop_list, "PCI_ID",
+				    pci_id);
+			parent = udev_parent_insert(udev, parent);
+		}
+	}
+	if (parent != NULL)
+		udev_device_set_parent(device, parent);
 	return (device);
 }
 
@@ -114,9 +204,26 @@ udev_device_new_from_subsystem_sysname(struct udev *udev,
    const char *subsystem, const char *sysname)
 {
 
+	char syspath[SYS_PATH_MAX];
+	struct udev_index *index;
+	unsigned long generation;
+	dev_t devnum;
+
 	TRC("(%s, %s)", subsystem, sysname);
-	UNIMPL();
-	return (NULL);
+	/* Same revalidation as udev_device_new_from_devnum() does */
+	index = udev_get_index(udev);
+	if (!udev_index_find_sysname(index, subsystem, sysname, syspath,
+	    sizeof(syspath), &devnum) ||
+	    (!udev_index_is_tracked(index) &&
+	    !devnode_matches(syspath, devnum))) {
+		generation = udev_index_get_generation(index);
+		if (get_syspath_by_subsystem_sysname(udev, subsystem, sysname,
+		    syspath, sizeof(syspath), &devnum) != 0)
+			return (NULL);
+		udev_index_add_since(index, syspath, devnum, generation);
+	}
+
+	return (udev_device_new_common(udev, syspath, UD_ACTION_NONE));
 }
 
 LIBUDEV_EXPORT char const *
@@ -129,10 +236,50 @@ udev_device_get_devnode(struct udev_device *ud)
 	return (devpath);
 }
 
+void
+udev_device_set_evdev_caps(struct udev_device *ud,
+    const struct evdev_caps *caps)
+{
+
+#ifdef HAVE_LINUX_INPUT_H
+	if (ud->evdev_caps == NULL)
+		ud->evdev_caps = malloc(sizeof(struct evdev_caps));
+	if (ud->evdev_caps != NULL) {
+		memcpy(ud->evdev_caps, caps, sizeof(struct evdev_caps));
+		atomic_store(&ud->caps_exported, false);
+	}
+#endif
+}
+
+/*
+ * Formats capability bitmaps kept since probe into properties. Properties
+ * of the same device can be read from several threads, so list is filled
+ * once under lock and not modified after that.
+ */
+static void
+udev_device_export_caps(struct udev_device *ud)
+{
+
+#ifdef HAVE_LINUX_INPUT_H
+	if (ud->evdev_caps == NULL ||
+	    atomic_load_explicit(&ud->caps_exported, memory_order_acquire))
+		return;
+
+	pthread_mutex_lock(&parent_mtx);
+	if (!atomic_load_explicit(&ud->caps_exported, memory_order_relaxed)) {
+		evdev_caps_set_props(ud->evdev_caps, &ud->prop_list);
+		atomic_store_explicit(&ud->caps_exported, true,
+		    memory_order_release);
+	}
+	pthread_mutex_unlock(&parent_mtx);
+#endif
+}
+
 struct udev_list *
 udev_device_get_properties_list(struct udev_device *ud)
 {
 
+	udev_device_export_caps(ud);
 	return (&ud->prop_list);
 }
 
@@ -196,6 +343,7 @@ udev_device_get_property_value(struct udev_device *ud, char const *property)
 	char const *key, *value;
 	struct udev_list_entry *entry;
 
+	udev_device_export_caps(ud);
 	udev_list_entry_foreach(entry, udev_list_entry_get_first(&ud->prop_list)) {
 		key = _udev_list_entry_get_name(entry);
 		if (!key)
@@ -238,8 +386,8 @@ udev_device_get_udev(struct udev_device *ud)
 	return (ud->udev);
 }
 
-struct udev_device *
-udev_device_new_common(struct udev *udev, const char *syspath, int action)
+static struct udev_device *
+udev_device_alloc(struct udev *udev, const char *syspath, int action)
 {
 	struct udev_device *ud;
 
@@ -252,18 +400,70 @@ udev_device_new_common(struct udev *udev, const char *syspath, int action)
 	ud->udev = udev;
 	ud->flags.action = action;
 	ud->parent = NULL;
+	atomic_init(&ud->parent_resolved, false);
+	atomic_init(&ud->caps_exported, false);
 	atomic_init(&ud->refcount, 1);
 	strcpy(ud->syspath, syspath);
 	udev_list_init(&ud->prop_list);
 	udev_list_init(&ud->sysattr_list);
 	udev_list_init(&ud->tag_list);
 	udev_list_init(&ud->devlink_list);
+
+	return (ud);
+}
+
+struct udev_device *
+udev_device_new_common(struct udev *udev, const char *syspath, int action)
+{
+	struct udev_device *ud;
+
+	ud = udev_device_alloc(udev, syspath, action);
+	if (ud == NULL)
+		return (NULL);
+	/* Tags do not need probe, so removed devices carry them too */
+	if (get_tags_by_syspath(udev, syspath, &ud->tag_list) < 0) {
+		udev_device_unref(ud);
+		return (NULL);
+	}
 	if (action != UD_ACTION_REMOVE)
 		invoke_create_handler(ud);
+	ud->stamps[UD_STAMP_PROBED] = monotonic_usec();
 
 	return (ud);
 }
 
+void
+udev_device_set_action(struct udev_device *ud, int action)
+{
+
+	ud->flags.action = action;
+}
+
+void
+udev_device_set_seqnum(struct udev_device *ud, unsigned long long seqnum)
+{
+
+	ud->seqnum = seqnum;
+}
+
+void
+udev_device_set_stamp(struct udev_device *ud, int stamp, uint64_t usec)
+{
+
+	ud->stamps[stamp] = usec;
+}
+
+/*
+ * Creates synthetic parent device. Create handler is not invoked as parent
+ * properties are filled by the child's one.
+ */
+struct udev_device *
+udev_device_new_parent(struct udev *udev, const char *syspath)
+{
+
+	return (udev_device_alloc(udev, syspath, UD_ACTION_NONE));
+}
+
 LIBUDEV_EXPORT const char *
 udev_device_get_syspath(struct udev_device *ud)
 {
@@ -287,7 +487,11 @@ udev_device_get_subsystem(struct udev_device *ud)
 {
 	const char *subsystem;
 
-	subsystem = get_subsystem_by_syspath(udev_device_get_syspath(ud));
+	subsystem = get_subsystem_by_syspath(ud->udev, ud->syspath);
+	/* Ancestors built from newbus data carry subsystem in properties */
+	if (strcmp(subsystem, UNKNOWN_SUBSYSTEM) == 0 &&
+	    udev_device_get_property_value(ud, "SUBSYSTEM") != NULL)
+		subsystem = udev_device_get_property_value(ud, "SUBSYSTEM");
 	TRC("(%p(%s)) %s", ud, ud->syspath, subsystem);
 	return (subsystem);
 }
@@ -297,21 +501,46 @@ udev_device_ref(struct udev_device *ud)
 {
 	TRC("(%p/%s) %d", ud, ud->syspath, ud->refcount);
 
-	if (!ud->flags.is_parent)
-		atomic_fetch_add(&ud->refcount, 1);
+	atomic_fetch_add(&ud->refcount, 1);
 	return (ud);
 }
 
+/* References device unless it is already being destroyed */
+bool
+udev_device_try_ref(struct udev_device *ud)
+{
+	int refcount;
+
+	refcount = atomic_load(&ud->refcount);
+	do {
+		if (refcount == 0)
+			return (false);
+	} while (!atomic_compare_exchange_weak(&ud->refcount, &refcount,
+	    refcount + 1));
+
+	return (true);
+}
+
+void
+udev_device_set_shared(struct udev_device *ud)
+{
+
+	ud->flags.shared = 1;
+}
+
 static void
 udev_device_free(struct udev_device *ud)
 {
 
+	if (ud->flags.shared)
+		udev_parent_remove(ud->udev, ud);
 	udev_list_free(&ud->prop_list);
 	udev_list_free(&ud->sysattr_list);
 	udev_list_free(&ud->tag_list);
 	udev_list_free(&ud->devlink_list);
+	free(ud->evdev_caps);
 	if (ud->parent != NULL)
-		udev_device_free(ud->parent);
+		udev_device_unref(ud->parent);
 	_udev_unref(ud->udev);
 	free(ud);
 }
@@ -321,36 +550,77 @@ udev_device_unref(struct udev_device *ud)
 {
 
 	TRC("(%p/%s) %d", ud, ud->syspath, ud->refcount);
-	if (ud->flags.is_parent)
-		return;
 	if (atomic_fetch_sub(&ud->refcount, 1) == 1)
 		udev_device_free(ud);
 }
 
+/*
+ * Returns parent device. Parents not set by create handler are resolved
+ * from newbus data on first request and memoized in the device.
+ */
+static struct udev_device *
+udev_device_resolve_parent(struct udev_device *ud)
+{
+
+	if (atomic_load_explicit(&ud->parent_resolved, memory_order_acquire))
+		return (ud->parent);
+
+	pthread_mutex_lock(&parent_mtx);
+	if (!atomic_load_explicit(&ud->parent_resolved,
+	    memory_order_relaxed)) {
+		if (ud->parent == NULL)
+			ud->parent = get_newbus_parent(ud);
+		atomic_store_explicit(&ud->parent_resolved, true,
+		    memory_order_release);
+	}
+	pthread_mutex_unlock(&parent_mtx);
+
+	return (ud->parent);
+}
+
 LIBUDEV_EXPORT struct udev_device *
 udev_device_get_parent(struct udev_device *ud)
 {
+	struct udev_device *parent;
 
-	TRC("(%p/%s) %p", ud, ud->syspath, ud->parent);
-	return (ud->parent);
+	parent = udev_device_resolve_parent(ud);
+	TRC("(%p/%s) %p", ud, ud->syspath, parent);
+	return (parent);
 }
 
 LIBUDEV_EXPORT struct udev_device *
 udev_device_get_parent_with_subsystem_devtype(struct udev_device *ud,
     const char *subsystem, const char *devtype)
 {
+	struct udev_device *parent;
+	const char *parent_devtype;
 
 	TRC("(%p/%s, %s, %s)", ud, ud->syspath, subsystem, devtype);
-	UNIMPL();
-	return (ud->parent);
+	for (parent = udev_device_resolve_parent(ud);
+	     parent != NULL;
+	     parent = udev_device_resolve_parent(parent)) {
+		if (strcmp(udev_device_get_subsystem(parent), subsystem) != 0)
+			continue;
+		if (devtype == NULL)
+			return (parent);
+		parent_devtype = udev_device_get_devtype(parent);
+		if (parent_devtype != NULL &&
+		    strcmp(parent_devtype, devtype) == 0)
+			return (parent);
+	}
+
+	return (NULL);
 }
 
+/* Consumes caller's reference to the parent */
 void
 udev_device_set_parent(struct udev_device *ud, struct udev_device *parent)
 {
 
-	parent->flags.is_parent = 1;
+	if (ud->parent != NULL)
+		udev_device_unref(ud->parent);
 	ud->parent = parent;
+	atomic_store_explicit(&ud->parent_resolved, true, memory_order_release);
 }
 
 LIBUDEV_EXPORT int
@@ -376,6 +646,9 @@ udev_device_get_action(struct udev_device *ud)
 	case UD_ACTION_REMOVE:
 		action = "remove";
 		break;
+	case UD_ACTION_CHANGE:
+		action = "change";
+		break;
 	default:
 		action = "unknown";
 	}
@@ -383,29 +656,90 @@ udev_device_get_action(struct udev_device *ud)
 	return (action);
 }
 
+/*
+ * Reads devnode identity into the cache. Returns 1 if cached identity has
+ * been changed, 0 if not and -1 if devnode is not a character device.
+ */
+static int
+udev_device_stat(struct udev_device *ud)
+{
+	struct stat st;
+	int changed;
+
+	if (devnode_stat(ud->syspath, &st) < 0) {
+		changed = ud->flags.stat_cached && ud->devnum != makedev(0, 0);
+		ud->devnum = makedev(0, 0);
+		ud->mode = 0;
+		ud->dev = 0;
+		ud->ino = 0;
+		ud->flags.stat_cached = 1;
+		return (changed ? 1 : -1);
+	}
+
+	changed = ud->flags.stat_cached &&
+	    (ud->devnum != st.st_rdev || ud->dev != st.st_dev ||
+	    ud->ino != st.st_ino);
+	ud->devnum = st.st_rdev;
+	ud->mode = st.st_mode;
+	ud->dev = st.st_dev;
+	ud->ino = st.st_ino;
+	ud->flags.stat_cached = 1;
+
+	return (changed ? 1 : 0);
+}
+
+/* Returns cached (st_dev, st_ino) identity of devnode */
+int
+udev_device_get_identity(struct udev_device *ud, dev_t *dev, ino_t *ino)
+{
+
+	if (!ud->flags.stat_cached)
+		udev_device_stat(ud);
+	if (ud->devnum == makedev(0, 0))
+		return (-1);
+
+	*dev = ud->dev;
+	*ino = ud->ino;
+	return (0);
+}
+
 LIBUDEV_EXPORT dev_t
 udev_device_get_devnum(struct udev_device *ud)
 {
-	const char *devpath;
-	struct stat st;
 
 	TRC("(%p) %s", ud, ud->syspath);
-	devpath = get_devpath_by_syspath(ud->syspath);
-	if (devpath == NULL ||
-	    stat(devpath, &st) < 0 ||
-	    !S_ISCHR(st.st_mode))
-		return (makedev(0, 0));
+	if (!ud->flags.stat_cached)
+		udev_device_stat(ud);
 
-	return (st.st_rdev);
+	return (ud->devnum);
+}
+
+/*
+ * Rereads devnode identity cached by udev_device_get_devnum(). Returns 1 if
+ * devnode has been replaced or removed since it was cached, 0 if it is
+ * still the same node and -1 if there is no character device node.
+ */
+LIBUDEV_EXPORT int
+udev_device_revalidate(struct udev_device *ud)
+{
+	int ret;
+
+	ret = udev_device_stat(ud);
+	TRC("(%p) %s %d", ud, ud->syspath, ret);
+	return (ret);
 }
 
 LIBUDEV_EXPORT const char *
 udev_device_get_devtype(struct udev_device *ud)
 {
+	const char *devtype;
 
-	TRC("(%p) %s", ud, ud->syspath);
-	UNIMPL();
-	return (NULL);
+	devtype = udev_device_get_property_value(ud, "DEVTYPE");
+	/* Removed devices are not probed */
+	if (devtype == NULL)
+		devtype = get_devtype_by_syspath(ud->udev, ud->syspath);
+	TRC("(%p(%s)) %s", ud, ud->syspath, devtype);
+	return (devtype);
 }
 
 LIBUDEV_EXPORT const char *
@@ -413,8 +747,7 @@ udev_device_get_driver(struct udev_device *ud)
 {
 
 	TRC("(%p) %s", ud, ud->syspath);
-	UNIMPL();
-	return (NULL);
+	return (udev_device_get_property_value(ud, "DRIVER"));
 }
 
 LIBUDEV_EXPORT const char *
@@ -430,8 +763,7 @@ udev_device_get_seqnum(struct udev_device *ud)
 {
 
 	TRC("(%p) %s", ud, ud->syspath);
-	UNIMPL();
-	return (0);
+	return (ud->seqnum);
 }
 
 LIBUDEV_EXPORT unsigned long long int
@@ -439,6 +771,29 @@ udev_device_get_usec_since_initialized(struct udev_device *ud)
 {
 
 	TRC("(%p) %s", ud, ud->syspath);
-	UNIMPL();
+	/* Synthetic parents are never probed */
+	if (ud->stamps[UD_STAMP_PROBED] == 0)
+		return (0);
+	return (monotonic_usec() - ud->stamps[UD_STAMP_PROBED]);
+}
+
+LIBUDEV_EXPORT int
+udev_device_get_event_timestamps(struct udev_device *ud,
+    unsigned long long *read_usec, unsigned long long *probed_usec,
+    unsigned long long *dequeued_usec)
+{
+
+	TRC("(%p) %s", ud, ud->syspath);
+	if (ud->seqnum == 0) {
+		errno = ENOENT;
+		return (-1);
+	}
+
+	if (read_usec != NULL)
+		*read_usec = ud->stamps[UD_STAMP_READ];
+	if (probed_usec != NULL)
+		*probed_usec = ud->stamps[UD_STAMP_PROBED];
+	if (dequeued_usec != NULL)
+		*dequeued_usec = ud->stamps[UD_STAMP_DEQUEUED];
 	return (0);
 }
@@ -4,15 +4,40 @@
 #include "libudev.h"
 #include "udev-list.h"
 
+#include <stdbool.h>
+#include <stdint.h>
+
+struct evdev_caps;
+
 /* udev_device flags */
 enum {
 	UD_ACTION_NONE,
 	UD_ACTION_ADD,
 	UD_ACTION_REMOVE,
+	UD_ACTION_CHANGE,
+};
+
+/* Event pipeline points stamped with CLOCK_MONOTONIC time */
+enum {
+	UD_STAMP_READ,		/* devd message has been read */
+	UD_STAMP_PROBED,	/* device has been probed */
+	UD_STAMP_DEQUEUED,	/* consumer has received the device */
+	UD_STAMP_MAX,
 };
 
 struct udev_device *udev_device_new_common(struct udev *udev,
     const char *syspath, int action);
+struct udev_device *udev_device_new_parent(struct udev *udev,
+    const char *syspath);
+bool udev_device_try_ref(struct udev_device *ud);
+void udev_device_set_action(struct udev_device *ud, int action);
+void udev_device_set_seqnum(struct udev_device *ud,
+    unsigned long long seqnum);
+void udev_device_set_stamp(struct udev_device *ud, int stamp, uint64_t usec);
+void udev_device_set_shared(struct udev_device *ud);
+int udev_device_get_identity(struct udev_device *ud, dev_t *dev, ino_t *ino);
+void udev_device_set_evdev_caps(struct udev_device *ud,
+    const struct evdev_caps *caps);
 struct udev_list *udev_device_get_properties_list(struct udev_device *ud);
 struct udev_list *udev_device_get_sysattr_list(struct udev_device *ud);
 struct udev_list *udev_device_get_tags_list(struct udev_device *ud);
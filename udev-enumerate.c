@@ -26,12 +26,15 @@
 
 #include "config.h"
 #include "libudev.h"
+#include "udev.h"
 #include "udev-filter.h"
+#include "udev-index.h"
 #include "udev-list.h"
 #include "udev-utils.h"
 #include "utils.h"
 
 #include <sys/types.h>
+#include <sys/stat.h>
 
 #include <dirent.h>
 #include <errno.h>
@@ -174,26 +177,110 @@ enumerate_cb(const char *path, int type, void *arg)
 {
 	struct udev_enumerate *ue = arg;
 	const char *syspath;
+	struct stat st;
 
 	if (type == DT_LNK || type == DT_CHR) {
 		syspath = get_syspath_by_devpath(path);
-		if (udev_filter_match(ue->udev, &ue->filters, syspath) &&
-		    udev_list_insert(&ue->dev_list, syspath, NULL) == -1)
+		/*
+		 * Feed index with every node of known subsystem so it can
+		 * answer devnum and tag lookups without walking /dev.
+		 */
+		if (strcmp(get_subsystem_by_syspath(ue->udev, syspath),
+		    UNKNOWN_SUBSYSTEM) != 0 &&
+		    stat(path, &st) == 0 && S_ISCHR(st.st_mode))
+			udev_index_add(udev_get_index(ue->udev), syspath,
+			    st.st_rdev);
+		if (!udev_filter_match(ue->udev, &ue->filters, syspath, true))
+			return (0);
+		if (udev_list_insert(&ue->dev_list, syspath, NULL) == -1)
 			return (-1);
 	}
 	return (0);
 }
 
+/* Leaves in syspaths only entries which are present in filter list too */
+static void
+udev_enumerate_intersect(struct udev_list *syspaths, struct udev_list *filter)
+{
+	struct udev_list_entry *ule, *next;
+
+	for (ule = udev_list_entry_get_first(syspaths); ule != NULL;
+	    ule = next) {
+		next = udev_list_entry_get_next(ule);
+		if (udev_list_find(filter,
+		    _udev_list_entry_get_name(ule)) == NULL)
+			udev_list_remove(syspaths, ule);
+	}
+}
+
+/*
+ * Answers enumerate with tag filters from complete index. Device has to
+ * carry every requested tag. Returns -1 if /dev has to be walked instead.
+ */
+static int
+udev_enumerate_scan_tags(struct udev_enumerate *ue)
+{
+	struct udev_index *index = udev_get_index(ue->udev);
+	struct udev_list tags, syspaths, tagged;
+	struct udev_list_entry *ule;
+	const char *name;
+	bool first = true;
+	int ret = -1;
+
+	if (!udev_index_is_complete(index))
+		return (-1);
+
+	udev_list_init(&tags);
+	udev_list_init(&syspaths);
+	udev_list_init(&tagged);
+	if (udev_filter_get_tags(&ue->filters, &tags) <= 0)
+		goto out;
+	udev_list_entry_foreach(ule, udev_list_entry_get_first(&tags)) {
+		name = _udev_list_entry_get_name(ule);
+		/* Index is keyed by exact tag */
+		if (strpbrk(name, "*?[") != NULL ||
+		    udev_index_find_tag(index, name,
+		    first ? &syspaths : &tagged) < 0)
+			goto out;
+		if (!first) {
+			udev_enumerate_intersect(&syspaths, &tagged);
+			udev_list_free(&tagged);
+		}
+		first = false;
+	}
+	udev_list_entry_foreach(ule, udev_list_entry_get_first(&syspaths)) {
+		name = _udev_list_entry_get_name(ule);
+		if (udev_filter_match(ue->udev, &ue->filters, name, true) &&
+		    udev_list_insert(&ue->dev_list, name, NULL) == -1) {
+			udev_list_free(&ue->dev_list);
+			goto out;
+		}
+	}
+	ret = 0;
+out:
+	udev_list_free(&tags);
+	udev_list_free(&syspaths);
+	udev_list_free(&tagged);
+	return (ret);
+}
+
 LIBUDEV_EXPORT int
 udev_enumerate_scan_devices(struct udev_enumerate *ue)
 {
+	struct udev_index *index = udev_get_index(ue->udev);
 	struct scan_ctx ctx;
-	char path[DEV_PATH_MAX] = DEV_PATH_ROOT "/";
+	char path[DEV_PATH_MAX];
+	unsigned long generation;
 	int ret;
 
 	TRC("(%p)", ue);
+	snprintf(path, sizeof(path), "%s/", udev_get_dev_path(ue->udev));
 
 	udev_list_free(&ue->dev_list);
+	if (udev_enumerate_scan_tags(ue) == 0)
+		return (0);
+
+	generation = udev_index_get_generation(index);
 	ctx = (struct scan_ctx) {
 		.recursive = true,
 		.cb = enumerate_cb,
@@ -201,6 +288,8 @@ udev_enumerate_scan_devices(struct udev_enumerate *ue)
 	};
 
 	ret = scandir_recursive(path, sizeof(path), &ctx);
+	if (ret == 0)
+		udev_index_set_complete(index, generation);
 #ifdef HAVE_DEVINFO_H
 	if (ret == 0)
 		ret = scandev_recursive(&ctx);
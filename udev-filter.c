@@ -27,6 +27,7 @@
 #include "config.h"
 #include "libudev.h"
 #include "udev-device.h"
+#include "udev-list.h"
 #include "udev-utils.h"
 #include "udev-filter.h"
 
@@ -96,6 +97,47 @@ udev_filter_free(struct udev_filter_head *ufh)
 	STAILQ_INIT(ufh);
 }
 
+/* Replaces contents of dst with copy of src. dst is intact on failure */
+int
+udev_filter_copy(struct udev_filter_head *dst, struct udev_filter_head *src)
+{
+	struct udev_filter_head tmp;
+	struct udev_filter_entry *ufe;
+
+	udev_filter_init(&tmp);
+	STAILQ_FOREACH(ufe, src, next) {
+		if (udev_filter_add(&tmp, ufe->type, ufe->neg, ufe->expr,
+		    ufe->value) < 0) {
+			udev_filter_free(&tmp);
+			return (-1);
+		}
+	}
+
+	udev_filter_free(dst);
+	while ((ufe = STAILQ_FIRST(&tmp)) != NULL) {
+		STAILQ_REMOVE_HEAD(&tmp, next);
+		STAILQ_INSERT_TAIL(dst, ufe, next);
+	}
+	return (0);
+}
+
+/* Adds patterns of tag filters to list. Returns number of tag filters */
+int
+udev_filter_get_tags(struct udev_filter_head *ufh, struct udev_list *tags)
+{
+	struct udev_filter_entry *ufe;
+	int count = 0;
+
+	STAILQ_FOREACH(ufe, ufh, next) {
+		if (ufe->type != UDEV_FILTER_TYPE_TAG)
+			continue;
+		if (udev_list_insert(tags, ufe->expr, NULL) < 0)
+			return (-1);
+		count++;
+	}
+	return (count);
+}
+
 static bool
 fnmatch_list(struct udev_list *list, struct udev_filter_entry *ufe)
 {
@@ -116,27 +158,54 @@ fnmatch_list(struct udev_list *list, struct udev_filter_entry *ufe)
 	return (false);
 }
 
+/* Subsystem filter may carry devtype pattern in its value */
+static bool
+fnmatch_subsystem_devtype(struct udev_filter_entry *ufe, const char *subsystem,
+    const char *devtype)
+{
+
+	if (fnmatch(ufe->expr, subsystem, 0) != 0)
+		return (false);
+	if (ufe->value == NULL)
+		return (true);
+	return (devtype != NULL && fnmatch(ufe->value, devtype, 0) == 0);
+}
+
+/*
+ * Tag filters are checked in addition to the others: device must carry all
+ * of requested tags if all_tags is set (enumerate) or at least one of them
+ * otherwise (monitor).
+ */
 bool
 udev_filter_match(struct udev *udev, struct udev_filter_head *ufh,
-    const char *syspath)
+    const char *syspath, bool all_tags)
 {
 	struct udev_filter_entry *ufe;
 	struct udev_device *ud = NULL;
-	const char *subsystem, *sysname;
+	struct udev_list taglist;
+	const char *subsystem, *sysname, *devtype;
+	bool tags = false;
 	int ret;
 
-	subsystem = get_subsystem_by_syspath(syspath);
+	subsystem = get_subsystem_by_syspath(udev, syspath);
 	if (strcmp(subsystem, UNKNOWN_SUBSYSTEM) == 0)
 		return (0);
 
 	sysname = get_sysname_by_syspath(syspath);
-	/* An empty filter list accepts everything. */
-	ret = STAILQ_EMPTY(ufh);
+	devtype = get_devtype_by_syspath(udev, syspath);
+	/* A filter list without non-tag entries accepts everything. */
+	ret = true;
+	STAILQ_FOREACH(ufe, ufh, next) {
+		if (ufe->type == UDEV_FILTER_TYPE_TAG)
+			tags = true;
+		else
+			ret = false;
+	}
 
 	STAILQ_FOREACH(ufe, ufh, next) {
 		if (ufe->type == UDEV_FILTER_TYPE_SUBSYSTEM &&
 		    ufe->neg == 0 &&
-		    fnmatch(ufe->expr, subsystem, 0) == 0) {
+		    fnmatch_subsystem_devtype(ufe, subsystem, devtype)) {
 			ret = true;
 			break;
 		}
@@ -147,7 +216,8 @@ udev_filter_match(struct udev *udev, struct udev_filter_head *ufh,
 			break;
 		}
 		if (ufe->type == UDEV_FILTER_TYPE_PROPERTY && ufe->neg == 0) {
-			ud = udev_device_new_common(udev, sysname, UD_ACTION_NONE);
+			ud = udev_device_new_common(udev, syspath,
+			    UD_ACTION_NONE);
 			if (ud == NULL)
 				break;
 			if (fnmatch_list(
@@ -158,7 +228,7 @@ udev_filter_match(struct udev *udev, struct udev_filter_head *ufh,
 		}
 		if (ufe->type == UDEV_FILTER_TYPE_SYSATTR && ufe->neg == 0) {
 			if (ud == NULL)
-				ud = udev_device_new_common(udev, sysname,
+				ud = udev_device_new_common(udev, syspath,
 				    UD_ACTION_NONE);
 			if (ud == NULL)
 				break;
@@ -176,7 +246,7 @@ udev_filter_match(struct udev *udev, struct udev_filter_head *ufh,
 	STAILQ_FOREACH(ufe, ufh, next) {
 		if (ufe->type == UDEV_FILTER_TYPE_SUBSYSTEM &&
 		    ufe->neg == 1 &&
-		    fnmatch(ufe->expr, subsystem, 0) == 0) {
+		    fnmatch_subsystem_devtype(ufe, subsystem, devtype)) {
 			ret = false;
 			break;
 		}
@@ -188,7 +258,7 @@ udev_filter_match(struct udev *udev, struct udev_filter_head *ufh,
 		}
 		if (ufe->type == UDEV_FILTER_TYPE_SYSATTR && ufe->neg == 1) {
 			if (ud == NULL)
-				ud = udev_device_new_common(udev, sysname,
+				ud = udev_device_new_common(udev, syspath,
 				    UD_ACTION_NONE);
 			if (ud == NULL)
 				break;
@@ -200,6 +270,24 @@ udev_filter_match(struct udev *udev, struct udev_filter_head *ufh,
 		}
 	}
 
+	if (!ret || !tags)
+		goto out;
+
+	/* Tags come from subsystem config and tag rules, no probe needed */
+	udev_list_init(&taglist);
+	ret = false;
+	if (get_tags_by_syspath(udev, syspath, &taglist) == 0) {
+		ret = all_tags;
+		STAILQ_FOREACH(ufe, ufh, next) {
+			if (ufe->type != UDEV_FILTER_TYPE_TAG ||
+			    fnmatch_list(&taglist, ufe) == all_tags)
+				continue;
+			ret = !all_tags;
+			break;
+		}
+	}
+	udev_list_free(&taglist);
+
 out:
 	if (ud != NULL)
 		udev_device_unref(ud);
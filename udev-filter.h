@@ -11,12 +11,17 @@ enum {
 	UDEV_FILTER_TYPE_SYSATTR,
 };
 STAILQ_HEAD(udev_filter_head, udev_filter_entry);
+struct udev_list;
 
 void udev_filter_init(struct udev_filter_head *ufh);
 bool udev_filter_match_subsystem(struct udev_filter_head *ufh,
     const char *subsystem);
 bool udev_filter_match(struct udev *udev, struct udev_filter_head *ufh,
-    const char *syspath);
+    const char *syspath, bool all_tags);
 int udev_filter_add(struct udev_filter_head *ufh, int type, int neg,
     const char *expr, const char *value);
+int udev_filter_copy(struct udev_filter_head *dst,
+    struct udev_filter_head *src);
+int udev_filter_get_tags(struct udev_filter_head *ufh,
+    struct udev_list *tags);
 void udev_filter_free(struct udev_filter_head *ufh);
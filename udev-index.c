@@ -0,0 +1,494 @@
+/*
+ * Copyright (c) 2015 Vladimir Kondratyev <wulf@cicgroup.ru>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "config.h"
+#include "udev-index.h"
+#include "udev-list.h"
+#include "udev-utils.h"
+#include "utils.h"
+
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/tree.h>
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Context-wide index of known device nodes. It is populated by enumerate
+ * and kept current by monitors so lookups by devnum, by subsystem and
+ * sysname or by tag do not touch kernel.
+ */
+struct udev_index_tag {
+	RB_ENTRY(udev_index_tag) link;
+	LIST_ENTRY(udev_index_tag) next;
+	struct udev_index_entry *uie;	/* NULL in lookup key */
+	char name[];
+};
+
+struct udev_index_entry {
+	RB_ENTRY(udev_index_entry) devnum_link;
+	RB_ENTRY(udev_index_entry) syspath_link;
+	RB_ENTRY(udev_index_entry) sysname_link;
+	LIST_HEAD(, udev_index_tag) tags;
+	dev_t devnum;
+	const char *subsystem;
+	const char *sysname;
+	char syspath[];
+};
+
+RB_HEAD(udev_index_devnum, udev_index_entry);
+RB_HEAD(udev_index_syspath, udev_index_entry);
+RB_HEAD(udev_index_sysname, udev_index_entry);
+RB_HEAD(udev_index_tags, udev_index_tag);
+
+struct udev_index {
+	struct udev *udev;	/* owner, not referenced */
+	pthread_mutex_t mtx;
+	_Atomic(int) monitors;
+	/* Bumped on removals and whenever devd events could have been missed */
+	unsigned long generation;
+	bool complete;		/* holds every node of known subsystem */
+	struct udev_index_devnum by_devnum;
+	struct udev_index_syspath by_syspath;
+	struct udev_index_sysname by_sysname;
+	struct udev_index_tags by_tag;
+};
+
+static int
+udev_index_devnum_cmp(struct udev_index_entry *uie1,
+    struct udev_index_entry *uie2)
+{
+
+	if (uie1->devnum == uie2->devnum)
+		return (0);
+	return (uie1->devnum < uie2->devnum ? -1 : 1);
+}
+
+static int
+udev_index_syspath_cmp(struct udev_index_entry *uie1,
+    struct udev_index_entry *uie2)
+{
+
+	return (strcmp(uie1->syspath, uie2->syspath));
+}
+
+static int
+udev_index_sysname_cmp(struct udev_index_entry *uie1,
+    struct udev_index_entry *uie2)
+{
+	int ret;
+
+	ret = strcmp(uie1->subsystem, uie2->subsystem);
+	if (ret == 0)
+		ret = strcmp(uie1->sysname, uie2->sysname);
+	return (ret);
+}
+
+/* Orders by tag, then by syspath. Lookup key goes before all its tag */
+static int
+udev_index_tag_cmp(struct udev_index_tag *uit1, struct udev_index_tag *uit2)
+{
+	int ret;
+
+	ret = strcmp(uit1->name, uit2->name);
+	if (ret != 0 || uit1->uie == uit2->uie)
+		return (ret);
+	if (uit1->uie == NULL)
+		return (-1);
+	if (uit2->uie == NULL)
+		return (1);
+	return (strcmp(uit1->uie->syspath, uit2->uie->syspath));
+}
+
+RB_GENERATE_STATIC(udev_index_devnum, udev_index_entry, devnum_link,
+    udev_index_devnum_cmp);
+RB_GENERATE_STATIC(udev_index_syspath, udev_index_entry, syspath_link,
+    udev_index_syspath_cmp);
+RB_GENERATE_STATIC(udev_index_sysname, udev_index_entry, sysname_link,
+    udev_index_sysname_cmp);
+RB_GENERATE_STATIC(udev_index_tags, udev_index_tag, link,
+    udev_index_tag_cmp);
+
+struct udev_index *
+udev_index_new(struct udev *udev)
+{
+	struct udev_index *ui;
+
+	ui = calloc(1, sizeof(struct udev_index));
+	if (ui == NULL)
+		return (NULL);
+
+	ui->udev = udev;
+	pthread_mutex_init(&ui->mtx, NULL);
+	atomic_init(&ui->monitors, 0);
+	RB_INIT(&ui->by_devnum);
+	RB_INIT(&ui->by_syspath);
+	RB_INIT(&ui->by_sysname);
+	RB_INIT(&ui->by_tag);
+
+	return (ui);
+}
+
+static struct udev_index_tag *
+udev_index_tag_alloc(const char *name)
+{
+	struct udev_index_tag *uit;
+
+	uit = calloc(1, offsetof(struct udev_index_tag, name) +
+	    strlen(name) + 1);
+	if (uit != NULL)
+		strcpy(uit->name, name);
+	return (uit);
+}
+
+static void
+udev_index_entry_free(struct udev_index_entry *uie)
+{
+	struct udev_index_tag *uit;
+
+	while ((uit = LIST_FIRST(&uie->tags)) != NULL) {
+		LIST_REMOVE(uit, next);
+		free(uit);
+	}
+	free(uie);
+}
+
+static void
+udev_index_entry_remove(struct udev_index *ui, struct udev_index_entry *uie)
+{
+	struct udev_index_tag *uit;
+
+	LIST_FOREACH(uit, &uie->tags, next)
+		RB_REMOVE(udev_index_tags, &ui->by_tag, uit);
+
+	if (uie->devnum != 0)
+		RB_REMOVE(udev_index_devnum, &ui->by_devnum, uie);
+	if (uie->subsystem != NULL)
+		RB_REMOVE(udev_index_sysname, &ui->by_sysname, uie);
+	RB_REMOVE(udev_index_syspath, &ui->by_syspath, uie);
+	udev_index_entry_free(uie);
+}
+
+void
+udev_index_free(struct udev_index *ui)
+{
+
+	udev_index_flush(ui);
+	pthread_mutex_destroy(&ui->mtx);
+	free(ui);
+}
+
+/* Called with ui->mtx held */
+static void
+udev_index_clear(struct udev_index *ui)
+{
+	struct udev_index_entry *uie1, *uie2;
+
+	RB_FOREACH_SAFE(uie1, udev_index_syspath, &ui->by_syspath, uie2)
+		udev_index_entry_remove(ui, uie1);
+	ui->generation++;
+	ui->complete = false;
+}
+
+/* Drops all entries. Used when devd events could have been missed */
+void
+udev_index_flush(struct udev_index *ui)
+{
+
+	pthread_mutex_lock(&ui->mtx);
+	udev_index_clear(ui);
+	pthread_mutex_unlock(&ui->mtx);
+}
+
+/*
+ * Inserts entry unless check is set and index has changed since given
+ * generation, i.e. the node could have been removed after caller looked it
+ * up.
+ */
+static int
+udev_index_insert(struct udev_index *ui, const char *syspath, dev_t devnum,
+    bool check, unsigned long generation)
+{
+	struct udev_index_entry *uie, *old_uie;
+	struct udev_index_tag *uit, *tmp;
+	struct udev_list_entry *ule;
+	struct udev_list tags;
+
+	uie = calloc(1, offsetof(struct udev_index_entry, syspath) +
+	    strlen(syspath) + 1);
+	if (uie == NULL)
+		return (-1);
+
+	uie->devnum = devnum;
+	strcpy(uie->syspath, syspath);
+	LIST_INIT(&uie->tags);
+	uie->sysname = get_sysname_by_syspath(uie->syspath);
+	uie->subsystem = get_subsystem_by_syspath(ui->udev, uie->syspath);
+	if (uie->sysname == NULL ||
+	    strcmp(uie->subsystem, UNKNOWN_SUBSYSTEM) == 0)
+		uie->subsystem = NULL;
+
+	udev_list_init(&tags);
+	if (uie->subsystem != NULL &&
+	    get_tags_by_syspath(ui->udev, uie->syspath, &tags) < 0)
+		goto error;
+	udev_list_entry_foreach(ule, udev_list_entry_get_first(&tags)) {
+		uit = udev_index_tag_alloc(_udev_list_entry_get_name(ule));
+		if (uit == NULL)
+			goto error;
+		uit->uie = uie;
+		LIST_INSERT_HEAD(&uie->tags, uit, next);
+	}
+	udev_list_free(&tags);
+
+	pthread_mutex_lock(&ui->mtx);
+	if (check && ui->generation != generation) {
+		pthread_mutex_unlock(&ui->mtx);
+		udev_index_entry_free(uie);
+		return (0);
+	}
+	/*
+	 * Node can be recreated with new devnum, devnum can be reused and
+	 * sysname can be taken by node in other directory. Newest node wins,
+	 * so inserts below do not collide.
+	 */
+	old_uie = RB_FIND(udev_index_syspath, &ui->by_syspath, uie);
+	if (old_uie != NULL)
+		udev_index_entry_remove(ui, old_uie);
+	if (devnum != 0 &&
+	    (old_uie = RB_FIND(udev_index_devnum, &ui->by_devnum, uie)) != NULL)
+		udev_index_entry_remove(ui, old_uie);
+	if (uie->subsystem != NULL &&
+	    (old_uie = RB_FIND(udev_index_sysname, &ui->by_sysname, uie)) !=
+	    NULL)
+		udev_index_entry_remove(ui, old_uie);
+	if (devnum != 0)
+		RB_INSERT(udev_index_devnum, &ui->by_devnum, uie);
+	if (uie->subsystem != NULL)
+		RB_INSERT(udev_index_sysname, &ui->by_sysname, uie);
+	RB_INSERT(udev_index_syspath, &ui->by_syspath, uie);
+	/* Tag entries are keyed by syspath too. Drop duplicate tags */
+	LIST_FOREACH_SAFE(uit, &uie->tags, next, tmp) {
+		if (RB_INSERT(udev_index_tags, &ui->by_tag, uit) != NULL) {
+			LIST_REMOVE(uit, next);
+			free(uit);
+		}
+	}
+	pthread_mutex_unlock(&ui->mtx);
+
+	return (0);
+error:
+	udev_list_free(&tags);
+	udev_index_entry_free(uie);
+	return (-1);
+}
+
+/* Adds node reported by devd */
+int
+udev_index_add(struct udev_index *ui, const char *syspath, dev_t devnum)
+{
+
+	return (udev_index_insert(ui, syspath, devnum, false, 0));
+}
+
+/*
+ * Adds node found by lookup started at given generation. Node is skipped
+ * if devd could have removed it meanwhile.
+ */
+int
+udev_index_add_since(struct udev_index *ui, const char *syspath,
+    dev_t devnum, unsigned long generation)
+{
+
+	return (udev_index_insert(ui, syspath, devnum, true, generation));
+}
+
+void
+udev_index_remove(struct udev_index *ui, const char *syspath)
+{
+	struct udev_index_entry *key, *uie;
+
+	key = calloc(1, offsetof(struct udev_index_entry, syspath) +
+	    strlen(syspath) + 1);
+	if (key == NULL)
+		return;
+	strcpy(key->syspath, syspath);
+
+	pthread_mutex_lock(&ui->mtx);
+	uie = RB_FIND(udev_index_syspath, &ui->by_syspath, key);
+	if (uie != NULL)
+		udev_index_entry_remove(ui, uie);
+	/* Lookups in flight could have seen the node */
+	ui->generation++;
+	pthread_mutex_unlock(&ui->mtx);
+	free(key);
+}
+
+bool
+udev_index_find_devnum(struct udev_index *ui, dev_t devnum, char *syspath,
+    size_t syspathlen)
+{
+	struct udev_index_entry key, *uie;
+	bool found = false;
+
+	key.devnum = devnum;
+	pthread_mutex_lock(&ui->mtx);
+	uie = RB_FIND(udev_index_devnum, &ui->by_devnum, &key);
+	if (uie != NULL && strlcpy(syspath, uie->syspath, syspathlen) <
+	    syspathlen)
+		found = true;
+	pthread_mutex_unlock(&ui->mtx);
+
+	return (found);
+}
+
+bool
+udev_index_find_sysname(struct udev_index *ui, const char *subsystem,
+    const char *sysname, char *syspath, size_t syspathlen, dev_t *devnum)
+{
+	struct udev_index_entry key, *uie;
+	bool found = false;
+
+	key.subsystem = subsystem;
+	key.sysname = sysname;
+	pthread_mutex_lock(&ui->mtx);
+	uie = RB_FIND(udev_index_sysname, &ui->by_sysname, &key);
+	if (uie != NULL && strlcpy(syspath, uie->syspath, syspathlen) <
+	    syspathlen) {
+		*devnum = uie->devnum;
+		found = true;
+	}
+	pthread_mutex_unlock(&ui->mtx);
+
+	return (found);
+}
+
+/* Adds syspaths of all nodes carrying the tag to the list */
+int
+udev_index_find_tag(struct udev_index *ui, const char *tag,
+    struct udev_list *syspaths)
+{
+	struct udev_index_tag *key, *uit;
+	int ret = 0;
+
+	key = udev_index_tag_alloc(tag);
+	if (key == NULL)
+		return (-1);
+
+	pthread_mutex_lock(&ui->mtx);
+	for (uit = RB_NFIND(udev_index_tags, &ui->by_tag, key);
+	    uit != NULL && strcmp(uit->name, tag) == 0;
+	    uit = RB_NEXT(udev_index_tags, &ui->by_tag, uit)) {
+		if (udev_list_insert(syspaths, uit->uie->syspath, NULL) < 0) {
+			ret = -1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&ui->mtx);
+	free(key);
+
+	return (ret);
+}
+
+/*
+ * Index can be trusted without revalidation only while some monitor of the
+ * context receives devd events and updates it.
+ */
+void
+udev_index_monitor_attach(struct udev_index *ui)
+{
+
+	/*
+	 * Entries added while untracked were verified only when inserted and
+	 * walks started before tracking could miss events.
+	 */
+	pthread_mutex_lock(&ui->mtx);
+	if (atomic_fetch_add(&ui->monitors, 1) == 0)
+		udev_index_clear(ui);
+	pthread_mutex_unlock(&ui->mtx);
+}
+
+void
+udev_index_monitor_detach(struct udev_index *ui)
+{
+
+	pthread_mutex_lock(&ui->mtx);
+	if (atomic_fetch_sub(&ui->monitors, 1) == 1) {
+		ui->generation++;
+		ui->complete = false;
+	}
+	pthread_mutex_unlock(&ui->mtx);
+}
+
+unsigned long
+udev_index_get_generation(struct udev_index *ui)
+{
+	unsigned long generation;
+
+	pthread_mutex_lock(&ui->mtx);
+	generation = ui->generation;
+	pthread_mutex_unlock(&ui->mtx);
+
+	return (generation);
+}
+
+/*
+ * Marks index as holding every node of known subsystem after full /dev walk
+ * started at given generation. Only tracked index stays complete.
+ */
+void
+udev_index_set_complete(struct udev_index *ui, unsigned long generation)
+{
+
+	pthread_mutex_lock(&ui->mtx);
+	if (ui->generation == generation && udev_index_is_tracked(ui))
+		ui->complete = true;
+	pthread_mutex_unlock(&ui->mtx);
+}
+
+bool
+udev_index_is_complete(struct udev_index *ui)
+{
+	bool complete;
+
+	pthread_mutex_lock(&ui->mtx);
+	complete = ui->complete;
+	pthread_mutex_unlock(&ui->mtx);
+
+	return (complete);
+}
+
+bool
+udev_index_is_tracked(struct udev_index *ui)
+{
+
+	return (atomic_load(&ui->monitors) > 0);
+}
@@ -0,0 +1,33 @@
+#ifndef UDEV_INDEX_H_
+#define UDEV_INDEX_H_
+
+#include <sys/types.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct udev;
+struct udev_index;
+struct udev_list;
+
+struct udev_index *udev_index_new(struct udev *udev);
+void udev_index_free(struct udev_index *ui);
+void udev_index_flush(struct udev_index *ui);
+int udev_index_add(struct udev_index *ui, const char *syspath, dev_t devnum);
+int udev_index_add_since(struct udev_index *ui, const char *syspath,
+    dev_t devnum, unsigned long generation);
+void udev_index_remove(struct udev_index *ui, const char *syspath);
+bool udev_index_find_devnum(struct udev_index *ui, dev_t devnum,
+    char *syspath, size_t syspathlen);
+bool udev_index_find_sysname(struct udev_index *ui, const char *subsystem,
+    const char *sysname, char *syspath, size_t syspathlen, dev_t *devnum);
+int udev_index_find_tag(struct udev_index *ui, const char *tag,
+    struct udev_list *syspaths);
+void udev_index_monitor_attach(struct udev_index *ui);
+void udev_index_monitor_detach(struct udev_index *ui);
+bool udev_index_is_tracked(struct udev_index *ui);
+unsigned long udev_index_get_generation(struct udev_index *ui);
+void udev_index_set_complete(struct udev_index *ui, unsigned long generation);
+bool udev_index_is_complete(struct udev_index *ui);
+
+#endif /* UDEV_INDEX_H_ */
@@ -85,6 +85,30 @@ udev_list_insert(struct udev_list *ul, char const *name, char const *value)
 	return (0);
 }
 
+struct udev_list_entry *
+udev_list_find(struct udev_list *ul, char const *name)
+{
+	struct udev_list_entry *key, *ule;
+
+	key = calloc(1, offsetof(struct udev_list_entry, name) +
+	    strlen(name) + 1);
+	if (key == NULL)
+		return (NULL);
+	strcpy(key->name, name);
+	ule = RB_FIND(udev_list, ul, key);
+	free(key);
+
+	return (ule);
+}
+
+void
+udev_list_remove(struct udev_list *ul, struct udev_list_entry *ule)
+{
+
+	RB_REMOVE(udev_list, ul, ule);
+	udev_list_entry_free(ule);
+}
+
 void
 udev_list_free(struct udev_list *ul)
 {
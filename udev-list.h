@@ -11,6 +11,9 @@ RB_HEAD(udev_list, udev_list_entry);
 void udev_list_init(struct udev_list *ul);
 int udev_list_insert(struct udev_list *ul, char const *name,
     char const *value);
+struct udev_list_entry *udev_list_find(struct udev_list *ul,
+    char const *name);
+void udev_list_remove(struct udev_list *ul, struct udev_list_entry *ule);
 void udev_list_free(struct udev_list *ul);
 struct udev_list_entry *udev_list_entry_get_first(struct udev_list *ul);
 const char *_udev_list_entry_get_name(struct udev_list_entry *ule);
@@ -26,29 +26,46 @@
 
 #include "config.h"
 #include "libudev.h"
+#include "event-loop.h"
+#include "latency-stats.h"
+#include "probe-pool.h"
 #include "udev.h"
 #include "udev-device.h"
+#include "udev-index.h"
 #include "udev-utils.h"
 #include "udev-filter.h"
+#include "udev-list.h"
 #include "udev-utils.h"
+#include "sysctl-cache.h"
 #include "utils.h"
 
 #include <sys/types.h>
-#include <sys/event.h>
 #include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-#define	DEVD_SOCK_PATH		"/var/run/devd.pipe"
-#define	DEVD_RECONNECT_INTERVAL	1000	/* reconnect after 1 second */
+#define	DEVD_RECONNECT_MIN	50	/* first retry after 50 ms */
+#define	DEVD_RECONNECT_MAX	10000	/* then back off up to 10 seconds */
+#define	DEVD_BUF_SIZE		8192
+/* Kernel devctl messages are bounded by DEVCTL_MAXBUF */
+#define	DEVD_MSG_MAX		1024
+/* Estimated memory footprint of queued event. Used to size the queue */
+#define	UDEV_MONITOR_EVENT_SIZE	1024
+#define	PROBE_WORKERS		4
 
 #define	DEVD_EVENT_ATTACH	'+'
 #define	DEVD_EVENT_DETACH	'-'
@@ -58,86 +75,331 @@
 STAILQ_HEAD(udev_monitor_queue_head, udev_monitor_queue_entry);
 struct udev_monitor_queue_entry {
 	struct udev_device *ud;
+	int action;
+	uint64_t queued;	/* monotonic time in microseconds */
 	STAILQ_ENTRY(udev_monitor_queue_entry) next;
 };
 
+/* Connection to devd socket together with its event loop and read buffer */
+struct devd_conn {
+	struct event_loop loop;
+	struct udev *udev;
+	int fd;
+	bool seqpacket;		/* one message per packet, '\0' terminated */
+	/* read buffer. Holds [rpos, rlen) unparsed bytes */
+	size_t rpos;
+	size_t rlen;
+	char rbuf[DEVD_BUF_SIZE];
+	uint64_t read_usec;	/* time of last read */
+	unsigned int reconnect_delay;	/* milliseconds, doubles on failure */
+	bool resync;		/* events could be lost since last connect */
+	struct udev_list known;	/* present devices of known subsystems */
+	/* statistics, read by udev_monitor_get_dispatch_stats() */
+	atomic_ulong loop_iterations;
+	atomic_ulong events;
+};
+
+/*
+ * Per-context owner of devd connection. Its thread parses every devd message
+ * once and fans it out to all threaded monitors of the context.
+ */
+struct udev_dispatcher {
+	struct devd_conn conn;
+	struct udev *udev;
+	struct probe_pool *pool;
+	pthread_t thread;
+	pthread_mutex_t mtx;	/* protects monitors list */
+	LIST_HEAD(, udev_monitor) monitors;
+	pthread_cond_t room_cv;	/* signalled when BLOCK queue gets shorter */
+	atomic_bool room_wait;	/* dispatcher waits on room_cv */
+	bool tracking;		/* index is updated by dispatcher thread */
+};
+
 struct udev_monitor {
 	_Atomic(int) refcount;
 	int fds[2];
-	int kq;
-	struct udev_filter_head filters;
+	bool inline_mode;	/* parse devd messages on caller's thread */
+	struct devd_conn *conn;			/* inline mode */
+	struct udev_dispatcher *dispatcher;	/* threaded mode */
+	LIST_ENTRY(udev_monitor) link;
+	struct udev_filter_head filters;	/* edited by add_match calls */
+	struct udev_filter_head active;		/* applied by filter_update */
 	struct udev *udev;
 	struct udev_monitor_queue_head queue;
-	pthread_mutex_t mtx;
-	pthread_t thread;
+	pthread_mutex_t mtx;	/* protects queue and its counters */
+	int queue_policy;
+	size_t queue_max;	/* 0 means unbounded */
+	_Atomic(size_t) queue_len;	/* read unlocked by receive fast path */
+	size_t inflight;	/* submitted to probe pool, not queued yet */
+	size_t queue_hwm;
+	unsigned long dropped;
+	unsigned long coalesced;	/* replaced in place by newer event */
+	unsigned int coalesce_window;	/* milliseconds, 0 disables folding */
+	unsigned long folded;
+	unsigned long long seqnum;	/* of last event sent to consumer */
 };
 
+/* Serializes creation and destruction of dispatchers */
+static pthread_mutex_t dispatcher_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * devd-replay(1) compatible event log named by LIBUDEV_DEVD_RECORD. It is
+ * shared by the whole process and fed by one connection at a time, so
+ * records of several contexts do not interleave.
+ */
+static pthread_once_t devd_record_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t devd_record_mtx = PTHREAD_MUTEX_INITIALIZER;
+static FILE *devd_record;
+static struct devd_conn *devd_record_owner;
+static uint64_t devd_record_start;
+
+static struct udev_device *udev_monitor_receive_inline(
+    struct udev_monitor *um);
+
+/*
+ * Notification pipe holds a byte exactly while the queue is not empty so
+ * monitor fd is level-triggered. Called with monitor mutex held.
+ */
+static int
+udev_monitor_queue_inserted(struct udev_monitor *um)
+{
+
+	if (um->queue_len == 0 && write(um->fds[1], "*", 1) != 1)
+		return (-1);
+	if (++um->queue_len > um->queue_hwm)
+		um->queue_hwm = um->queue_len;
+	return (0);
+}
+
+static void
+udev_monitor_queue_removed(struct udev_monitor *um)
+{
+	char buf[1];
+
+	if (--um->queue_len == 0)
+		while (read(um->fds[0], buf, sizeof(buf)) > 0)
+			;
+}
+
+/*
+ * BLOCK queue which can not take another event once pending probes finish.
+ * Called with monitor mutex held.
+ */
+static bool
+udev_monitor_queue_full(struct udev_monitor *um)
+{
+
+	return (um->queue_policy == UDEV_MONITOR_QUEUE_BLOCK &&
+	    um->queue_max > 0 && um->queue_len + um->inflight >= um->queue_max);
+}
+
+/*
+ * Wakes dispatcher up if it holds events back until some BLOCK queue gets
+ * shorter. Called without monitor mutex held.
+ */
+static void
+udev_monitor_wake_dispatcher(struct udev_monitor *um)
+{
+	struct udev_dispatcher *ud = um->dispatcher;
+
+	if (ud != NULL && atomic_load(&ud->room_wait)) {
+		pthread_mutex_lock(&ud->mtx);
+		pthread_cond_broadcast(&ud->room_cv);
+		pthread_mutex_unlock(&ud->mtx);
+	}
+}
+
 LIBUDEV_EXPORT struct udev_device *
 udev_monitor_receive_device(struct udev_monitor *um)
 {
 	struct udev_monitor_queue_entry *umqe;
 	struct udev_device *ud;
-	char buf[1];
+	uint64_t start;
 
 	TRC("(%p)", um);
-	if (read(um->fds[0], buf, 1) < 0)
-		return (NULL);
+	if (um->conn != NULL)
+		return (udev_monitor_receive_inline(um));
 
-	if (STAILQ_EMPTY(&um->queue))
+	/* Do not touch the lock or the pipe when there is nothing to pop */
+	start = LATENCY_NOW();
+	if (atomic_load(&um->queue_len) == 0) {
+		errno = EAGAIN;
 		return (NULL);
+	}
 
 	pthread_mutex_lock(&um->mtx);
 	umqe = STAILQ_FIRST(&um->queue);
+	if (umqe == NULL) {
+		/* Folded away after fast path check */
+		pthread_mutex_unlock(&um->mtx);
+		errno = EAGAIN;
+		return (NULL);
+	}
 	STAILQ_REMOVE_HEAD(&um->queue, next);
+	udev_monitor_queue_removed(um);
 	pthread_mutex_unlock(&um->mtx);
+	udev_monitor_wake_dispatcher(um);
 	ud = umqe->ud;
+	LATENCY_RECORD(UDEV_LATENCY_QUEUE, umqe->queued);
 	free(umqe);
+	udev_device_set_stamp(ud, UD_STAMP_DEQUEUED, monotonic_usec());
+	LATENCY_RECORD(UDEV_LATENCY_DEQUEUE, start);
 
 	return (ud);
 }
 
+/*
+ * Folds new event into unconsumed one of the same syspath queued less than
+ * coalescing window ago: add followed by remove cancel each other, remove
+ * followed by add becomes change. Returns true if event has been folded.
+ * Called with monitor mutex held.
+ */
+static bool
+udev_monitor_queue_fold(struct udev_monitor *um, const char *syspath,
+    int action, struct udev_device *ud)
+{
+	struct udev_monitor_queue_entry *umqe, *last;
+
+	if (um->coalesce_window == 0)
+		return (false);
+
+	last = NULL;
+	STAILQ_FOREACH(umqe, &um->queue, next)
+		if (strcmp(udev_device_get_syspath(umqe->ud), syspath) == 0)
+			last = umqe;
+	if (last == NULL ||
+	    monotonic_usec() - last->queued >
+	    (uint64_t)um->coalesce_window * 1000)
+		return (false);
+
+	if (action == UD_ACTION_REMOVE && last->action == UD_ACTION_ADD) {
+		STAILQ_REMOVE(&um->queue, last, udev_monitor_queue_entry, next);
+		udev_monitor_queue_removed(um);
+		udev_device_unref(last->ud);
+		free(last);
+	} else if (action == UD_ACTION_ADD &&
+	    last->action == UD_ACTION_REMOVE) {
+		udev_device_set_action(ud, UD_ACTION_CHANGE);
+		udev_device_unref(last->ud);
+		last->ud = ud;
+		last->action = UD_ACTION_CHANGE;
+	} else
+		return (false);
+
+	um->folded++;
+	return (true);
+}
+
+/*
+ * Makes room for new event in full queue according to monitor policy.
+ * Returns entry whose device should be replaced or NULL if there is a free
+ * slot. Called with monitor mutex held.
+ */
+static struct udev_monitor_queue_entry *
+udev_monitor_queue_evict(struct udev_monitor *um, const char *syspath)
+{
+	struct udev_monitor_queue_entry *umqe;
+
+	if (um->queue_max == 0 || um->queue_len < um->queue_max)
+		return (NULL);
+
+	if (um->queue_policy == UDEV_MONITOR_QUEUE_COALESCE) {
+		STAILQ_FOREACH(umqe, &um->queue, next) {
+			if (strcmp(udev_device_get_syspath(umqe->ud),
+			    syspath) == 0) {
+				um->coalesced++;
+				return (umqe);
+			}
+		}
+	}
+
+	um->dropped++;
+
+	/* Drop oldest, reuse its entry */
+	umqe = STAILQ_FIRST(&um->queue);
+	STAILQ_REMOVE_HEAD(&um->queue, next);
+	STAILQ_INSERT_TAIL(&um->queue, umqe, next);
+
+	return (umqe);
+}
+
 static int
 udev_monitor_send_device(struct udev_monitor *um, const char *syspath,
-    int action)
+    const struct probe_event *ev)
 {
-	struct udev_monitor_queue_entry *umqe;
+	struct udev_monitor_queue_entry *umqe, *old;
+	struct udev_device *ud;
+	int action = ev->action;
+	uint64_t start;
 
-	umqe = calloc(1, sizeof(struct udev_monitor_queue_entry));
-	if (umqe == NULL)
+	/* Room in BLOCK queue has been reserved by dispatcher */
+	pthread_mutex_lock(&um->mtx);
+	if (action == UD_ACTION_REMOVE &&
+	    udev_monitor_queue_fold(um, syspath, action, NULL)) {
+		pthread_mutex_unlock(&um->mtx);
+		return (0);
+	}
+	pthread_mutex_unlock(&um->mtx);
+
+	start = LATENCY_NOW();
+	ud = udev_device_new_common(um->udev, syspath, action);
+	LATENCY_RECORD(UDEV_LATENCY_PROBE, start);
+	if (ud == NULL)
 		return (-1);
+	udev_device_set_seqnum(ud, ev->seqnum);
+	udev_device_set_stamp(ud, UD_STAMP_READ, ev->read_usec);
 
-	umqe->ud = udev_device_new_common(um->udev, syspath, action);
-	if (umqe->ud == NULL) {
-		free(umqe);
+	/* Allocated in advance so queue is checked and filled atomically */
+	umqe = calloc(1, sizeof(struct udev_monitor_queue_entry));
+	if (umqe == NULL) {
+		udev_device_unref(ud);
 		return (-1);
 	}
 
 	pthread_mutex_lock(&um->mtx);
-	STAILQ_INSERT_TAIL(&um->queue, umqe, next);
-	pthread_mutex_unlock(&um->mtx);
-
-	if (write(um->fds[1], "*", 1) != 1) {
-		pthread_mutex_lock(&um->mtx);
-		STAILQ_REMOVE(&um->queue, umqe, udev_monitor_queue_entry, next);
+	if (action == UD_ACTION_ADD &&
+	    udev_monitor_queue_fold(um, syspath, action, ud))
+		goto done;
+	old = udev_monitor_queue_evict(um, syspath);
+	if (old != NULL) {
+		udev_device_unref(old->ud);
+		old->ud = ud;
+		old->action = action;
+		old->queued = monotonic_usec();
+		goto done;
+	}
+	if (udev_monitor_queue_inserted(um) < 0) {
 		pthread_mutex_unlock(&um->mtx);
-		udev_device_unref(umqe->ud);
+		udev_device_unref(ud);
 		free(umqe);
 		return (-1);
 	}
+	umqe->ud = ud;
+	umqe->action = action;
+	umqe->queued = monotonic_usec();
+	STAILQ_INSERT_TAIL(&um->queue, umqe, next);
+	umqe = NULL;
+done:
+	pthread_mutex_unlock(&um->mtx);
+	free(umqe);
 
 	return (0);
 }
 
 static int
-parse_devd_message(char *msg, char *syspath, size_t syspathlen)
+parse_devd_message(struct udev *udev, char *msg, char *syspath,
+    size_t syspathlen)
 {
-	char devpath[DEV_PATH_MAX] = DEV_PATH_ROOT "/";
+	char devpath[DEV_PATH_MAX];
 	const char *type, *dev_name;
 	size_t type_len, dev_len, root_len;
 	int action;
 
-	root_len = strlen(devpath);
+	root_len = snprintf(devpath, sizeof(devpath), "%s/",
+	    udev_get_dev_path(udev));
 	action = UD_ACTION_NONE;
+	if (root_len >= sizeof(devpath))
+		return (action);
 
 	switch (msg[0]) {
 #ifdef HAVE_DEVINFO_H
@@ -182,87 +444,815 @@ parse_devd_message(char *msg, char *syspath, size_t syspathlen)
 	return (action);
 }
 
-/* Opens devd socket and set read kevent on success or timer kevent on failure */
+static void
+devd_record_open(void)
+{
+	const char *path;
+
+	path = getenv_secure("LIBUDEV_DEVD_RECORD");
+	if (path != NULL && (devd_record = fopen(path, "ae")) == NULL)
+		ERR("Can not open %s", path);
+}
+
+static void
+devd_record_line(struct devd_conn *dc, const char *line)
+{
+
+	pthread_mutex_lock(&devd_record_mtx);
+	if (devd_record_owner == NULL)
+		devd_record_owner = dc;
+	if (devd_record_owner == dc) {
+		if (devd_record_start == 0)
+			devd_record_start = dc->read_usec;
+		fprintf(devd_record, "%ju %s\n",
+		    (uintmax_t)(dc->read_usec - devd_record_start), line);
+		fflush(devd_record);
+	}
+	pthread_mutex_unlock(&devd_record_mtx);
+}
+
+/* Lets another connection continue the log */
+static void
+devd_record_release(struct devd_conn *dc)
+{
+
+	pthread_mutex_lock(&devd_record_mtx);
+	if (devd_record_owner == dc)
+		devd_record_owner = NULL;
+	pthread_mutex_unlock(&devd_record_mtx);
+}
+
 static int
-devd_connect(int kq)
+devd_conn_init(struct devd_conn *dc, struct udev *udev)
 {
-	int devd_fd;
-	struct kevent ke;
 
-	devd_fd = socket_connect(DEVD_SOCK_PATH);
+	pthread_once(&devd_record_once, devd_record_open);
+	dc->udev = udev;
+	dc->fd = -1;
+	dc->rpos = 0;
+	dc->rlen = 0;
+	dc->reconnect_delay = DEVD_RECONNECT_MIN;
+	dc->resync = false;
+	udev_list_init(&dc->known);
+	atomic_init(&dc->loop_iterations, 0);
+	atomic_init(&dc->events, 0);
+	if (event_loop_init(&dc->loop) < 0)
+		return (-1);
 
-	if (devd_fd >= 0) {
-		EV_SET(&ke, devd_fd, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, 0);
-		if (kevent(kq, &ke, 1, NULL, 0, NULL) < 0) {
-			close(devd_fd);
-			devd_fd = -1;
-		}
+	return (0);
+}
+
+/*
+ * Opens devd socket and set read event on success or timer event on failure.
+ * Retry interval grows exponentially while devd stays unreachable.
+ */
+static int
+devd_connect(struct devd_conn *dc)
+{
+	const char *path;
+
+	/*
+	 * Prefer message-oriented transport. Custom socket path may accept
+	 * either socket type.
+	 */
+	path = udev_get_devd_socket(dc->udev);
+	dc->seqpacket = true;
+	dc->fd = socket_connect(strcmp(path, DEVD_SOCK_PATH) == 0 ?
+	    DEVD_SEQPACKET_SOCK_PATH : path, SOCK_SEQPACKET);
+	if (dc->fd < 0) {
+		dc->seqpacket = false;
+		dc->fd = socket_connect(path, SOCK_STREAM);
+	}
+
+	if (dc->fd >= 0 && event_loop_add_read(&dc->loop, dc->fd) < 0) {
+		close(dc->fd);
+		dc->fd = -1;
+	}
+
+	if (dc->fd >= 0) {
+		dc->reconnect_delay = DEVD_RECONNECT_MIN;
+		return (0);
 	}
 
 	/* Set respawn timer */
-	if (devd_fd < 0) {
-		EV_SET(&ke, 1, EVFILT_TIMER, EV_ADD | EV_ENABLE | EV_ONESHOT,
-		    0, DEVD_RECONNECT_INTERVAL, 0);
-		if (kevent(kq, &ke, 1, NULL, 0, NULL) < 0)
-			devd_fd = -1;
+	event_loop_set_timer(&dc->loop, dc->reconnect_delay);
+	dc->reconnect_delay *= 2;
+	if (dc->reconnect_delay > DEVD_RECONNECT_MAX)
+		dc->reconnect_delay = DEVD_RECONNECT_MAX;
+	dc->resync = true;
+
+	return (-1);
+}
+
+static void
+devd_disconnect(struct devd_conn *dc)
+{
+
+	if (dc->fd >= 0)
+		close(dc->fd);
+	dc->fd = -1;
+	dc->rpos = 0;
+	dc->rlen = 0;
+}
+
+static void
+devd_conn_close(struct devd_conn *dc)
+{
+
+	devd_disconnect(dc);
+	event_loop_close(&dc->loop);
+	udev_list_free(&dc->known);
+	if (devd_record != NULL)
+		devd_record_release(dc);
+}
+
+/* Moves unparsed bytes to the beginning of read buffer */
+static void
+devd_compact(struct devd_conn *dc)
+{
+
+	if (dc->rpos > 0) {
+		memmove(dc->rbuf, dc->rbuf + dc->rpos, dc->rlen - dc->rpos);
+		dc->rlen -= dc->rpos;
+		dc->rpos = 0;
+	}
+}
+
+/*
+ * Appends pending devd packets to read buffer with one recvmsg(2) per
+ * message while there is room for the largest one. Every message is stored
+ * '\0'-terminated, so no line scanning is needed later.
+ */
+static int
+devd_fill_seqpacket(struct devd_conn *dc)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	uint64_t start;
+	ssize_t ret;
+	int flags = 0;
+
+	devd_compact(dc);
+	while (sizeof(dc->rbuf) - dc->rlen > DEVD_MSG_MAX) {
+		iov.iov_base = dc->rbuf + dc->rlen;
+		/* Reserve room for terminator */
+		iov.iov_len = sizeof(dc->rbuf) - dc->rlen - 1;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+
+		start = LATENCY_NOW();
+		ret = recvmsg(dc->fd, &msg, flags);
+		LATENCY_RECORD(UDEV_LATENCY_READ, start);
+		/* Only the first receive may block */
+		flags = MSG_DONTWAIT;
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if (ret <= 0)
+			return (-1);
+		if (msg.msg_flags & MSG_TRUNC) {
+			ERR("Oversized devd message dropped");
+			continue;
+		}
+		if (dc->rbuf[dc->rlen + ret - 1] == '\n')
+			ret--;
+		dc->rbuf[dc->rlen + ret] = '\0';
+		dc->rlen += ret + 1;
+	}
+
+	return (0);
+}
+
+/*
+ * Appends up to avail bytes pending on devd socket to read buffer with single
+ * read(2). avail is -1 if event loop backend does not report it.
+ */
+static int
+devd_fill(struct devd_conn *dc, ssize_t avail)
+{
+	uint64_t start;
+	size_t space;
+	ssize_t ret;
+
+	if (dc->seqpacket)
+		return (devd_fill_seqpacket(dc));
+
+	devd_compact(dc);
+	space = sizeof(dc->rbuf) - dc->rlen;
+	/* Line does not fit in buffer */
+	if (space == 0)
+		return (-1);
+	if (avail > 0 && (size_t)avail < space)
+		space = avail;
+
+	start = LATENCY_NOW();
+	ret = read(dc->fd, dc->rbuf + dc->rlen, space);
+	LATENCY_RECORD(UDEV_LATENCY_READ, start);
+	if (ret <= 0)
+		return (-1);
+	dc->rlen += ret;
+
+	return (0);
+}
+
+/*
+ * Handles readable devd socket event. Returns -1 and drops connection on
+ * EOF or error.
+ */
+static int
+devd_read(struct devd_conn *dc, struct event_loop_event *ele)
+{
+
+	if ((ele->eof && ele->data == 0) || devd_fill(dc, ele->data) < 0) {
+		devd_disconnect(dc);
+		dc->resync = true;
+		return (-1);
+	}
+	dc->read_usec = monotonic_usec();
+
+	return (0);
+}
+
+/* Returns next complete line from read buffer or NULL if there is none */
+static char *
+devd_next_line(struct devd_conn *dc)
+{
+	char *line, *end;
+
+	line = dc->rbuf + dc->rpos;
+	end = dc->seqpacket ? NULL : memchr(line, '\n', dc->rlen - dc->rpos);
+	if (end == NULL)
+		end = memchr(line, '\0', dc->rlen - dc->rpos);
+	if (end == NULL)
+		return (NULL);
+
+	*end = '\0';
+	dc->rpos += end - line + 1;
+	atomic_fetch_add(&dc->events, 1);
+
+	if (devd_record != NULL)
+		devd_record_line(dc, line);
+
+	return (line);
+}
+
+/* Keeps context-wide device index and sysctl cache current */
+static void
+udev_monitor_update_index(struct udev *udev, const char *syspath,
+    int action)
+{
+	struct udev_index *index;
+	struct stat st;
+	char mib[64];
+	size_t len;
+
+	index = udev_get_index(udev);
+	if (action == UD_ACTION_REMOVE) {
+		udev_index_remove(index, syspath);
+		/* OIDs of detached newbus device can be reused by other one */
+		len = syspathlen_wo_units(syspath);
+		if (strchr(syspath, '/') == NULL && syspath[len] != '\0') {
+			snprintf(mib, sizeof(mib), "dev.%.*s.%s.", (int)len,
+			    syspath, syspath + len);
+			sysctl_cache_invalidate(mib);
+		}
+	} else if (strcmp(get_subsystem_by_syspath(udev, syspath),
+	    UNKNOWN_SUBSYSTEM) != 0 &&
+	    stat(get_devpath_by_syspath(syspath), &st) == 0 &&
+	    S_ISCHR(st.st_mode)) {
+		/* Same node set as enumerate_cb() feeds */
+		udev_index_add(index, syspath, st.st_rdev);
+	}
+}
+
+static int
+devd_scan_cb(const char *path, int type, void *arg)
+{
+	struct devd_conn *dc = arg;
+	const char *syspath;
+
+	if (type == DT_LNK || type == DT_CHR) {
+		syspath = get_syspath_by_devpath(path);
+		if (strcmp(get_subsystem_by_syspath(dc->udev, syspath),
+		    UNKNOWN_SUBSYSTEM) != 0 &&
+		    udev_list_insert(&dc->known, syspath, NULL) == -1)
+			return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Fills known-device set with present devices of known subsystems. Monitor
+ * filters are applied when events are synthesized, so set stays valid
+ * across filter updates. Must not be called with any lock held.
+ */
+static int
+devd_scan(struct devd_conn *dc)
+{
+	struct scan_ctx ctx;
+	char path[DEV_PATH_MAX];
+	int ret;
+
+	snprintf(path, sizeof(path), "%s/", udev_get_dev_path(dc->udev));
+	udev_list_free(&dc->known);
+	ctx = (struct scan_ctx) {
+		.recursive = true,
+		.cb = devd_scan_cb,
+		.args = dc,
+	};
+
+	ret = scandir_recursive(path, sizeof(path), &ctx);
+#ifdef HAVE_DEVINFO_H
+	if (ret == 0)
+		ret = scandev_recursive(&ctx);
+#endif
+	return (ret);
+}
+
+/* Applies devd event to known-device set */
+static void
+devd_track(struct devd_conn *dc, const char *syspath, int action)
+{
+	struct udev_list_entry *ule;
+
+	if (action == UD_ACTION_ADD) {
+		if (strcmp(get_subsystem_by_syspath(dc->udev, syspath),
+		    UNKNOWN_SUBSYSTEM) != 0)
+			udev_list_insert(&dc->known, syspath, NULL);
+	} else if ((ule = udev_list_find(&dc->known, syspath)) != NULL)
+		udev_list_remove(&dc->known, ule);
+}
+
+typedef void (*devd_emit_fn)(void *arg, const char *syspath, int action);
+
+/* Calls emit for every entry of sorted list l1 which is missing in l2 */
+static void
+devd_diff(struct udev_list *l1, struct udev_list *l2, int action,
+    devd_emit_fn emit, void *arg)
+{
+	struct udev_list_entry *ule1, *ule2;
+	const char *name;
+	int cmp;
+
+	ule2 = udev_list_entry_get_first(l2);
+	udev_list_entry_foreach(ule1, udev_list_entry_get_first(l1)) {
+		name = _udev_list_entry_get_name(ule1);
+		cmp = 1;
+		while (ule2 != NULL &&
+		    (cmp = strcmp(_udev_list_entry_get_name(ule2), name)) < 0)
+			ule2 = udev_list_entry_get_next(ule2);
+		if (cmp != 0)
+			emit(arg, name, action);
+	}
+}
+
+/*
+ * Rescans devices after devd connection has been restored and synthesizes
+ * events missed in between: removals first, then additions, each group in
+ * syspath order. Walk runs unlocked, emit takes locks it needs per event.
+ */
+static void
+devd_resync(struct devd_conn *dc, devd_emit_fn emit, void *arg)
+{
+	struct udev_list old;
+
+	old = dc->known;
+	udev_list_init(&dc->known);
+	if (devd_scan(dc) < 0) {
+		ERR("Device rescan failed, missed events are lost");
+		udev_list_free(&dc->known);
+		dc->known = old;
+		return;
+	}
+
+	devd_diff(&old, &dc->known, UD_ACTION_REMOVE, emit, arg);
+	devd_diff(&dc->known, &old, UD_ACTION_ADD, emit, arg);
+	udev_list_free(&old);
+}
+
+/* Runs on probe pool worker */
+static void
+udev_monitor_probe(void *owner, const char *syspath,
+    const struct probe_event *ev)
+{
+	struct udev_monitor *um = owner;
+
+	udev_monitor_send_device(um, syspath, ev);
+
+	/* Event has been queued, folded or lost: release its reservation */
+	pthread_mutex_lock(&um->mtx);
+	um->inflight--;
+	pthread_mutex_unlock(&um->mtx);
+	udev_monitor_wake_dispatcher(um);
+}
+
+/*
+ * Holds events back while some BLOCK monitor has no room for another one,
+ * so probe workers never wait for consumers and pending probes stay
+ * bounded. Devd input is paused meanwhile, so index is not trusted until
+ * dispatcher goes on. Called with ud->mtx held, which is released while
+ * waiting.
+ */
+static void
+udev_dispatcher_wait_room(struct udev_dispatcher *ud)
+{
+	struct udev_index *index = udev_get_index(ud->udev);
+	struct udev_monitor *um;
+	bool full, paused = false;
+
+	atomic_store(&ud->room_wait, true);
+	for (;;) {
+		full = false;
+		LIST_FOREACH(um, &ud->monitors, link) {
+			pthread_mutex_lock(&um->mtx);
+			full = udev_monitor_queue_full(um);
+			pthread_mutex_unlock(&um->mtx);
+			if (full)
+				break;
+		}
+		if (!full)
+			break;
+		if (!paused && ud->tracking) {
+			udev_index_monitor_detach(index);
+			paused = true;
+		}
+		pthread_cond_wait(&ud->room_cv, &ud->mtx);
+	}
+	atomic_store(&ud->room_wait, false);
+	/* Entries are dropped on retracking, queued devd events refill them */
+	if (paused)
+		udev_index_monitor_attach(index);
+}
+
+/* Queues event to every monitor accepting it. Called with ud->mtx held */
+static void
+udev_dispatcher_fanout(struct udev_dispatcher *ud, const char *syspath,
+    int action, uint64_t read_usec)
+{
+	struct udev_monitor *um;
+	struct probe_event pe;
+	uint64_t start;
+	bool match;
+
+	udev_dispatcher_wait_room(ud);
+	pe.action = action;
+	pe.read_usec = read_usec;
+	LIST_FOREACH(um, &ud->monitors, link) {
+		start = LATENCY_NOW();
+		match = udev_filter_match(um->udev, &um->active, syspath,
+		    false);
+		LATENCY_RECORD(UDEV_LATENCY_FILTER, start);
+		if (!match)
+			continue;
+		pe.seqnum = ++um->seqnum;
+		pthread_mutex_lock(&um->mtx);
+		um->inflight++;
+		pthread_mutex_unlock(&um->mtx);
+		if (probe_pool_submit(ud->pool, um, syspath, &pe) < 0) {
+			pthread_mutex_lock(&um->mtx);
+			um->inflight--;
+			pthread_mutex_unlock(&um->mtx);
+		}
 	}
+}
+
+/* Queues synthesized event like dispatcher thread does with devd ones */
+static void
+udev_dispatcher_emit(void *arg, const char *syspath, int action)
+{
+	struct udev_dispatcher *ud = arg;
 
-	return (devd_fd);
+	pthread_mutex_lock(&ud->mtx);
+	udev_dispatcher_fanout(ud, syspath, action, monotonic_usec());
+	pthread_mutex_unlock(&ud->mtx);
+}
+
+static void
+udev_dispatcher_resync(struct udev_dispatcher *ud)
+{
+
+	/* Index entries of devices nobody monitors could have gone stale */
+	udev_index_flush(udev_get_index(ud->udev));
+	devd_resync(&ud->conn, udev_dispatcher_emit, ud);
 }
 
 static void *
-udev_monitor_thread(void *args)
+udev_dispatcher_thread(void *args)
 {
-	struct udev_monitor *um = args;
-	char ev[1024], syspath[DEV_PATH_MAX];
-	int devd_fd = -1, ret, action;
-	struct kevent ke;
+	struct udev_dispatcher *ud = args;
+	struct devd_conn *dc = &ud->conn;
+	struct event_loop_event ele[EVENT_LOOP_MAX_EVENTS];
+	struct udev_index *index = udev_get_index(ud->udev);
+	char syspath[DEV_PATH_MAX], *line;
+	uint64_t start;
+	int ret, action, i;
+	bool done = false;
 	sigset_t set;
 
 	sigfillset(&set);
 	pthread_sigmask(SIG_BLOCK, &set, NULL);
 
-	for (;;) {
-		if (devd_fd < 0)
-			devd_fd = devd_connect(um->kq);
+	/* Reference point for resync after devd connection loss */
+	if (devd_scan(dc) < 0)
+		ERR("Device scan failed");
+
+	while (!done) {
+		/* Index is kept current only while connected */
+		if (dc->fd < 0 && devd_connect(dc) == 0) {
+			if (dc->resync) {
+				dc->resync = false;
+				udev_dispatcher_resync(ud);
+			}
+			udev_index_monitor_attach(index);
+			ud->tracking = true;
+		}
 
-		ret = kevent(um->kq, NULL, 0, &ke, 1, NULL);
+		ret = event_loop_wait(&dc->loop, ele, EVENT_LOOP_MAX_EVENTS,
+		    -1);
 		if (ret == -1 && errno == EINTR)
 			continue;
 		if (ret < 1)
 			break;
+		atomic_fetch_add(&dc->loop_iterations, 1);
 
-		/* edev_monitor is finishing */
-		if (ke.filter == EVFILT_USER)
-			break;
+		for (i = 0; i < ret; i++) {
+			/* last monitor is finishing */
+			if (ele[i].type == EVENT_LOOP_WAKEUP) {
+				done = true;
+				break;
+			}
 
-		/* connection respawn timer expired */
-		if (ke.filter == EVFILT_TIMER) {
-			continue;
+			/* connection respawn timer expired */
+			if (ele[i].type == EVENT_LOOP_TIMER)
+				continue;
+
+			/* XXX: assert() should be placed here */
+			if (ele[i].type != EVENT_LOOP_READ ||
+			    ele[i].fd != dc->fd)
+				continue;
+
+			if (devd_read(dc, &ele[i]) < 0) {
+				udev_index_monitor_detach(index);
+				ud->tracking = false;
+				continue;
+			}
+
+			/* Drain all complete lines before blocking again */
+			while ((line = devd_next_line(dc)) != NULL) {
+				start = LATENCY_NOW();
+				action = parse_devd_message(ud->udev, line,
+				    syspath, sizeof(syspath));
+				LATENCY_RECORD(UDEV_LATENCY_PARSE, start);
+				if (action == UD_ACTION_NONE)
+					continue;
+				udev_monitor_update_index(ud->udev, syspath,
+				    action);
+				devd_track(dc, syspath, action);
+				pthread_mutex_lock(&ud->mtx);
+				udev_dispatcher_fanout(ud, syspath, action,
+				    dc->read_usec);
+				pthread_mutex_unlock(&ud->mtx);
+			}
 		}
+	}
 
-		/* XXX: assert() should be placed here */
-		if (ke.filter != EVFILT_READ)
-			continue;
+	if (ud->tracking)
+		udev_index_monitor_detach(index);
+	devd_disconnect(dc);
 
-		if (ke.flags & EV_EOF ||
-		    socket_readline(devd_fd, ev, sizeof(ev)) < 0) {
-			close(devd_fd);
-			devd_fd = -1;
-			continue;
+	return (NULL);
+}
+
+/* Subscribes monitor to context-wide dispatcher starting it if necessary */
+static int
+udev_dispatcher_attach(struct udev_monitor *um)
+{
+	struct udev_dispatcher *ud;
+
+	pthread_mutex_lock(&dispatcher_mtx);
+	ud = udev_get_dispatcher(um->udev);
+	if (ud == NULL) {
+		ud = calloc(1, sizeof(struct udev_dispatcher));
+		if (ud == NULL)
+			goto error;
+		if (devd_conn_init(&ud->conn, um->udev) < 0) {
+			free(ud);
+			goto error;
+		}
+		ud->udev = um->udev;
+		pthread_mutex_init(&ud->mtx, NULL);
+		pthread_cond_init(&ud->room_cv, NULL);
+		LIST_INIT(&ud->monitors);
+		ud->pool = probe_pool_new(PROBE_WORKERS, udev_monitor_probe);
+		if (ud->pool == NULL) {
+			pthread_cond_destroy(&ud->room_cv);
+			pthread_mutex_destroy(&ud->mtx);
+			devd_conn_close(&ud->conn);
+			free(ud);
+			goto error;
 		}
+		if (pthread_create(&ud->thread, NULL, udev_dispatcher_thread,
+		    ud) != 0) {
+			ERR("thread_create failed");
+			probe_pool_free(ud->pool);
+			pthread_cond_destroy(&ud->room_cv);
+			pthread_mutex_destroy(&ud->mtx);
+			devd_conn_close(&ud->conn);
+			free(ud);
+			goto error;
+		}
+		udev_set_dispatcher(um->udev, ud);
+	}
 
-		action = parse_devd_message(ev, syspath, sizeof(syspath));
+	pthread_mutex_lock(&ud->mtx);
+	um->dispatcher = ud;
+	LIST_INSERT_HEAD(&ud->monitors, um, link);
+	pthread_mutex_unlock(&ud->mtx);
+	pthread_mutex_unlock(&dispatcher_mtx);
 
-		if (action != UD_ACTION_NONE) {
-			if (udev_filter_match(um->udev, &um->filters, syspath))
-				udev_monitor_send_device(um, syspath, action);
+	return (0);
+error:
+	pthread_mutex_unlock(&dispatcher_mtx);
+	return (-1);
+}
+
+/* Unsubscribes monitor. Stops dispatcher after last monitor has gone */
+static void
+udev_dispatcher_detach(struct udev_monitor *um)
+{
+	struct udev_dispatcher *ud = um->dispatcher;
+	bool last;
+
+	pthread_mutex_lock(&dispatcher_mtx);
+	pthread_mutex_lock(&ud->mtx);
+	LIST_REMOVE(um, link);
+	last = LIST_EMPTY(&ud->monitors);
+	/* Release dispatcher thread if it waits for room in our queue */
+	pthread_cond_broadcast(&ud->room_cv);
+	pthread_mutex_unlock(&ud->mtx);
+	probe_pool_cancel(ud->pool, um);
+
+	if (last) {
+		udev_set_dispatcher(um->udev, NULL);
+		event_loop_wakeup(&ud->conn.loop);
+		pthread_join(ud->thread, NULL);
+		probe_pool_free(ud->pool);
+		devd_conn_close(&ud->conn);
+		pthread_cond_destroy(&ud->room_cv);
+		pthread_mutex_destroy(&ud->mtx);
+		free(ud);
+	}
+	pthread_mutex_unlock(&dispatcher_mtx);
+	um->dispatcher = NULL;
+}
+
+/* Probes synthesized event on caller's thread and queues it for receive */
+static void
+udev_monitor_emit_inline(void *arg, const char *syspath, int action)
+{
+	struct udev_monitor *um = arg;
+	struct udev_monitor_queue_entry *umqe;
+	struct udev_device *ud;
+
+	if (!udev_filter_match(um->udev, &um->active, syspath, false))
+		return;
+	ud = udev_device_new_common(um->udev, syspath, action);
+	if (ud == NULL)
+		return;
+	umqe = calloc(1, sizeof(struct udev_monitor_queue_entry));
+	if (umqe == NULL) {
+		udev_device_unref(ud);
+		return;
+	}
+	udev_device_set_seqnum(ud, ++um->seqnum);
+	udev_device_set_stamp(ud, UD_STAMP_READ, monotonic_usec());
+	umqe->ud = ud;
+	umqe->action = action;
+	umqe->queued = monotonic_usec();
+	STAILQ_INSERT_TAIL(&um->queue, umqe, next);
+}
+
+static void
+udev_monitor_connect_inline(struct udev_monitor *um)
+{
+	struct devd_conn *dc = um->conn;
+
+	if (devd_connect(dc) == 0 && dc->resync) {
+		dc->resync = false;
+		devd_resync(dc, udev_monitor_emit_inline, um);
+	}
+}
+
+/*
+ * Thread-free counterpart of udev_dispatcher_thread(). Never blocks, returns
+ * NULL if there are no more pending devd messages.
+ */
+static struct udev_device *
+udev_monitor_receive_inline(struct udev_monitor *um)
+{
+	struct devd_conn *dc = um->conn;
+	struct event_loop_event ele[EVENT_LOOP_MAX_EVENTS];
+	struct udev_monitor_queue_entry *umqe;
+	struct udev_device *ud;
+	char syspath[DEV_PATH_MAX], *line;
+	uint64_t start;
+	int ret, action, i;
+	bool match;
+
+	for (;;) {
+		/* Events synthesized on reconnect go first */
+		if ((umqe = STAILQ_FIRST(&um->queue)) != NULL) {
+			STAILQ_REMOVE_HEAD(&um->queue, next);
+			ud = umqe->ud;
+			free(umqe);
+			udev_device_set_stamp(ud, UD_STAMP_DEQUEUED,
+			    monotonic_usec());
+			return (ud);
+		}
+
+		while ((line = devd_next_line(dc)) != NULL) {
+			start = LATENCY_NOW();
+			action = parse_devd_message(um->udev, line, syspath,
+			    sizeof(syspath));
+			LATENCY_RECORD(UDEV_LATENCY_PARSE, start);
+			if (action == UD_ACTION_NONE)
+				continue;
+			udev_monitor_update_index(um->udev, syspath, action);
+			devd_track(dc, syspath, action);
+			start = LATENCY_NOW();
+			match = udev_filter_match(um->udev, &um->active,
+			    syspath, false);
+			LATENCY_RECORD(UDEV_LATENCY_FILTER, start);
+			if (!match)
+				continue;
+			start = LATENCY_NOW();
+			ud = udev_device_new_common(um->udev, syspath, action);
+			LATENCY_RECORD(UDEV_LATENCY_PROBE, start);
+			if (ud == NULL)
+				continue;
+			udev_device_set_seqnum(ud, ++um->seqnum);
+			udev_device_set_stamp(ud, UD_STAMP_READ, dc->read_usec);
+			udev_device_set_stamp(ud, UD_STAMP_DEQUEUED,
+			    monotonic_usec());
+			return (ud);
+		}
+
+		ret = event_loop_wait(&dc->loop, ele, EVENT_LOOP_MAX_EVENTS, 0);
+		if (ret < 1) {
+			if (ret == 0)
+				errno = EAGAIN;
+			return (NULL);
+		}
+		atomic_fetch_add(&dc->loop_iterations, 1);
+
+		for (i = 0; i < ret; i++) {
+			if (ele[i].type == EVENT_LOOP_TIMER && dc->fd < 0)
+				udev_monitor_connect_inline(um);
+			else if (ele[i].type == EVENT_LOOP_READ &&
+			    ele[i].fd == dc->fd && devd_read(dc, &ele[i]) < 0)
+				udev_monitor_connect_inline(um);
 		}
 	}
+}
+
+LIBUDEV_EXPORT struct udev_device *
+udev_monitor_receive_device_timeout(struct udev_monitor *um, int timeout)
+{
+	struct udev_device *ud;
+	struct pollfd pfd;
+	uint64_t deadline = 0;
+	int64_t left;
 
-	if (devd_fd >= 0)
-		close(devd_fd);
+	TRC("(%p, %d)", um, timeout);
+	if (timeout > 0)
+		deadline = monotonic_usec() + (uint64_t)timeout * 1000;
 
+	for (;;) {
+		ud = udev_monitor_receive_device(um);
+		if (ud != NULL || timeout == 0)
+			return (ud);
+
+		/* Monitor fd stays readable while something is pending */
+		if (timeout > 0) {
+			left = deadline - monotonic_usec();
+			if (left <= 0)
+				break;
+			timeout = (left + 999) / 1000;
+		}
+		pfd.fd = udev_monitor_get_fd(um);
+		pfd.events = POLLIN;
+		switch (poll(&pfd, 1, timeout)) {
+		case -1:
+			if (errno == EINTR)
+				continue;
+			return (NULL);
+		case 0:
+			errno = ETIMEDOUT;
+			return (NULL);
+		}
+	}
+
+	errno = ETIMEDOUT;
 	return (NULL);
 }
 
@@ -276,7 +1266,7 @@ udev_monitor_new_from_netlink(struct udev *udev, const char *name)
 	if (!um)
 		return (NULL);
 
-	if (pipe2(um->fds, O_CLOEXEC) == -1) {
+	if (pipe2(um->fds, O_CLOEXEC | O_NONBLOCK) == -1) {
 		ERR("pipe2 failed");
 		free(um);
 		return (NULL);
@@ -284,11 +1274,13 @@ udev_monitor_new_from_netlink(struct udev *udev, const char *name)
 
 	um->udev = udev;
 	_udev_ref(udev);
-	um->kq = -1;
 	atomic_init(&um->refcount, 1);
+	atomic_init(&um->queue_len, 0);
 	udev_filter_init(&um->filters);
+	udev_filter_init(&um->active);
 	STAILQ_INIT(&um->queue);
 	pthread_mutex_init(&um->mtx, NULL);
+	um->queue_policy = UDEV_MONITOR_QUEUE_DROP_OLDEST;
 
 	return (um);
 }
@@ -300,36 +1292,74 @@ udev_monitor_filter_add_match_subsystem_devtype(struct udev_monitor *um,
 
 	TRC("(%p, %s, %s)", um, subsystem, devtype);
 	return (udev_filter_add(&um->filters, UDEV_FILTER_TYPE_SUBSYSTEM, 0,
-	    subsystem, NULL));
+	    subsystem, devtype));
 }
 
 LIBUDEV_EXPORT int
-udev_monitor_enable_receiving(struct udev_monitor *um)
+udev_monitor_filter_add_match_tag(struct udev_monitor *um, const char *tag)
 {
 
+	TRC("(%p, %s)", um, tag);
+	return (udev_filter_add(&um->filters, UDEV_FILTER_TYPE_TAG, 0, tag,
+	    NULL));
+}
+
+/* Makes filters added so far effective for receiving monitor */
+LIBUDEV_EXPORT int
+udev_monitor_filter_update(struct udev_monitor *um)
+{
+	struct udev_dispatcher *ud = um->dispatcher;
+	int ret;
+
 	TRC("(%p)", um);
-	struct kevent ev;
+	if (ud != NULL)
+		pthread_mutex_lock(&ud->mtx);
+	ret = udev_filter_copy(&um->active, &um->filters);
+	if (ud != NULL)
+		pthread_mutex_unlock(&ud->mtx);
 
-	um->kq = kqueue();
-	if (um->kq < 0)
-		goto error;
+	return (ret);
+}
 
-	EV_SET(&ev, 1, EVFILT_USER, EV_ADD | EV_ENABLE | EV_CLEAR, 0, 0, 0);
-	if (kevent(um->kq, &ev, 1, NULL, 0, NULL) < 0)
-		goto error;
+LIBUDEV_EXPORT int
+udev_monitor_filter_remove(struct udev_monitor *um)
+{
+
+	TRC("(%p)", um);
+	udev_filter_free(&um->filters);
+	return (udev_monitor_filter_update(um));
+}
+
+LIBUDEV_EXPORT int
+udev_monitor_enable_receiving(struct udev_monitor *um)
+{
 
-	if (pthread_create(&um->thread, NULL, udev_monitor_thread, um) != 0) {
-		ERR("thread_create failed");
-		goto error;
+	TRC("(%p)", um);
+	if (um->conn != NULL || um->dispatcher != NULL)
+		return (0);
+
+	if (udev_filter_copy(&um->active, &um->filters) < 0)
+		return (-1);
+	if (!um->inline_mode)
+		return (udev_dispatcher_attach(um));
+
+	/*
+	 * Events are processed only when caller asks for them so do not let
+	 * index trust its entries.
+	 */
+	um->conn = calloc(1, sizeof(struct devd_conn));
+	if (um->conn == NULL)
+		return (-1);
+	if (devd_conn_init(um->conn, um->udev) < 0) {
+		free(um->conn);
+		um->conn = NULL;
+		return (-1);
 	}
+	if (devd_scan(um->conn) < 0)
+		ERR("Device scan failed");
+	udev_monitor_connect_inline(um);
 
 	return (0);
-error:
-	if (um->kq >= 0) {
-		close (um->kq);
-		um->kq = -1;
-	}
-	return (-1);
 }
 
 LIBUDEV_EXPORT int
@@ -337,9 +1367,171 @@ udev_monitor_get_fd(struct udev_monitor *um)
 {
 
 	/* TRC("(%p)", um); */
+	if (um->inline_mode)
+		return (um->conn != NULL ? um->conn->loop.fd : -1);
 	return (um->fds[0]);
 }
 
+LIBUDEV_EXPORT int
+udev_monitor_set_inline(struct udev_monitor *um, int enable)
+{
+
+	TRC("(%p, %d)", um, enable);
+	if (um->conn != NULL || um->dispatcher != NULL) {
+		errno = EBUSY;
+		return (-1);
+	}
+
+	/* Notification pipe is needed by monitor thread only */
+	if (enable && um->fds[0] >= 0) {
+		close(um->fds[0]);
+		close(um->fds[1]);
+		um->fds[0] = um->fds[1] = -1;
+	} else if (!enable && um->fds[0] < 0 &&
+	    pipe2(um->fds, O_CLOEXEC | O_NONBLOCK) == -1) {
+		ERR("pipe2 failed");
+		return (-1);
+	}
+	um->inline_mode = enable != 0;
+
+	return (0);
+}
+
+LIBUDEV_EXPORT int
+udev_monitor_set_queue_limit(struct udev_monitor *um, size_t capacity,
+    int policy)
+{
+
+	TRC("(%p, %zu, %d)", um, capacity, policy);
+	if (policy != UDEV_MONITOR_QUEUE_BLOCK &&
+	    policy != UDEV_MONITOR_QUEUE_DROP_OLDEST &&
+	    policy != UDEV_MONITOR_QUEUE_COALESCE) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	pthread_mutex_lock(&um->mtx);
+	um->queue_max = capacity;
+	um->queue_policy = policy;
+	pthread_mutex_unlock(&um->mtx);
+	udev_monitor_wake_dispatcher(um);
+
+	return (0);
+}
+
+LIBUDEV_EXPORT int
+udev_monitor_set_receive_buffer_size(struct udev_monitor *um, int size)
+{
+	size_t capacity;
+
+	TRC("(%p, %d)", um, size);
+	if (size <= 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	capacity = size / UDEV_MONITOR_EVENT_SIZE;
+	pthread_mutex_lock(&um->mtx);
+	um->queue_max = capacity > 0 ? capacity : 1;
+	pthread_mutex_unlock(&um->mtx);
+	udev_monitor_wake_dispatcher(um);
+
+	return (0);
+}
+
+LIBUDEV_EXPORT unsigned long
+udev_monitor_get_dropped(struct udev_monitor *um)
+{
+	unsigned long dropped;
+
+	pthread_mutex_lock(&um->mtx);
+	dropped = um->dropped;
+	pthread_mutex_unlock(&um->mtx);
+
+	return (dropped);
+}
+
+LIBUDEV_EXPORT unsigned long
+udev_monitor_get_coalesced(struct udev_monitor *um)
+{
+	unsigned long coalesced;
+
+	pthread_mutex_lock(&um->mtx);
+	coalesced = um->coalesced;
+	pthread_mutex_unlock(&um->mtx);
+
+	return (coalesced);
+}
+
+LIBUDEV_EXPORT size_t
+udev_monitor_get_queue_high_water(struct udev_monitor *um)
+{
+	size_t hwm;
+
+	pthread_mutex_lock(&um->mtx);
+	hwm = um->queue_hwm;
+	pthread_mutex_unlock(&um->mtx);
+
+	return (hwm);
+}
+
+LIBUDEV_EXPORT int
+udev_monitor_set_coalesce_window(struct udev_monitor *um, unsigned int msec)
+{
+
+	TRC("(%p, %u)", um, msec);
+	pthread_mutex_lock(&um->mtx);
+	um->coalesce_window = msec;
+	pthread_mutex_unlock(&um->mtx);
+
+	return (0);
+}
+
+LIBUDEV_EXPORT unsigned long
+udev_monitor_get_folded(struct udev_monitor *um)
+{
+	unsigned long folded;
+
+	pthread_mutex_lock(&um->mtx);
+	folded = um->folded;
+	pthread_mutex_unlock(&um->mtx);
+
+	return (folded);
+}
+
+LIBUDEV_EXPORT int
+udev_monitor_get_probe_stats(struct udev_monitor *um,
+    struct udev_monitor_probe_stats *stats)
+{
+
+	TRC("(%p)", um);
+	if (um->dispatcher == NULL) {
+		errno = ENXIO;
+		return (-1);
+	}
+
+	probe_pool_get_stats(um->dispatcher->pool, stats);
+	return (0);
+}
+
+LIBUDEV_EXPORT int
+udev_monitor_get_dispatch_stats(struct udev_monitor *um,
+    struct udev_monitor_dispatch_stats *stats)
+{
+	struct devd_conn *dc;
+
+	TRC("(%p)", um);
+	dc = um->dispatcher != NULL ? &um->dispatcher->conn : um->conn;
+	if (dc == NULL) {
+		errno = ENXIO;
+		return (-1);
+	}
+
+	stats->loop_iterations = atomic_load(&dc->loop_iterations);
+	stats->events = atomic_load(&dc->events);
+	return (0);
+}
+
 LIBUDEV_EXPORT struct udev_monitor *
 udev_monitor_ref(struct udev_monitor *um)
 {
@@ -365,18 +1557,21 @@ udev_monitor_queue_drop(struct udev_monitor_queue_head *umqh)
 LIBUDEV_EXPORT void
 udev_monitor_unref(struct udev_monitor *um)
 {
-	struct kevent ev;
 
 	TRC("(%p) refcount=%d", um, um->refcount);
 	if (atomic_fetch_sub(&um->refcount, 1) == 1) {
-		EV_SET(&ev, 1, EVFILT_USER, 0, NOTE_TRIGGER, 0, 0);
-		kevent(um->kq, &ev, 1, NULL, 0, NULL);
-		pthread_join(um->thread, NULL);
-		close(um->kq);
-
-		close(um->fds[0]);
-		close(um->fds[1]);
+		if (um->dispatcher != NULL)
+			udev_dispatcher_detach(um);
+		if (um->conn != NULL) {
+			devd_conn_close(um->conn);
+			free(um->conn);
+		}
+		if (um->fds[0] >= 0) {
+			close(um->fds[0]);
+			close(um->fds[1]);
+		}
 		udev_filter_free(&um->filters);
+		udev_filter_free(&um->active);
 		udev_monitor_queue_drop(&um->queue);
 		pthread_mutex_destroy(&um->mtx);
 		_udev_unref(um->udev);
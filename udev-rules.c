@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2015 Vladimir Kondratyev <wulf@cicgroup.ru>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "config.h"
+#include "udev-list.h"
+#include "udev-rules.h"
+#include "utils.h"
+
+#include <sys/types.h>
+#include <sys/queue.h>
+
+#include <errno.h>
+#include <fnmatch.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Tag rules assign extra tags to device nodes. Every line of rules file
+ * holds shell pattern of node path relative to device root followed by
+ * whitespace separated tags, e.g. "ums1 seat seat1". Lines starting with
+ * '#' are comments.
+ */
+struct udev_rule {
+	STAILQ_ENTRY(udev_rule) next;
+	char *tag;
+	char pattern[];
+};
+
+struct udev_rules {
+	STAILQ_HEAD(, udev_rule) rules;
+};
+
+static int
+udev_rules_add(struct udev_rules *ur, const char *pattern, const char *tag)
+{
+	struct udev_rule *rule;
+	size_t patternlen;
+
+	patternlen = strlen(pattern) + 1;
+	rule = calloc(1, offsetof(struct udev_rule, pattern) + patternlen +
+	    strlen(tag) + 1);
+	if (rule == NULL)
+		return (-1);
+
+	strcpy(rule->pattern, pattern);
+	rule->tag = rule->pattern + patternlen;
+	strcpy(rule->tag, tag);
+	STAILQ_INSERT_TAIL(&ur->rules, rule, next);
+	return (0);
+}
+
+/* Missing rules file yields empty rule set */
+struct udev_rules *
+udev_rules_load(const char *path)
+{
+	struct udev_rules *ur;
+	FILE *fp;
+	char *line = NULL, *pattern, *tag, *last;
+	size_t linecap = 0;
+	int ret = 0;
+
+	ur = calloc(1, sizeof(struct udev_rules));
+	if (ur == NULL)
+		return (NULL);
+	STAILQ_INIT(&ur->rules);
+
+	fp = fopen(path, "re");
+	if (fp == NULL) {
+		if (errno != ENOENT)
+			ERR("Can not open %s", path);
+		return (ur);
+	}
+
+	while (ret == 0 && getline(&line, &linecap, fp) > 0) {
+		pattern = strtok_r(line, " \t\n", &last);
+		if (pattern == NULL || pattern[0] == '#')
+			continue;
+		while (ret == 0 &&
+		    (tag = strtok_r(NULL, " \t\n", &last)) != NULL)
+			ret = udev_rules_add(ur, pattern, tag);
+	}
+	free(line);
+	fclose(fp);
+
+	if (ret < 0) {
+		udev_rules_free(ur);
+		return (NULL);
+	}
+	return (ur);
+}
+
+void
+udev_rules_free(struct udev_rules *ur)
+{
+	struct udev_rule *rule;
+
+	while ((rule = STAILQ_FIRST(&ur->rules)) != NULL) {
+		STAILQ_REMOVE_HEAD(&ur->rules, next);
+		free(rule);
+	}
+	free(ur);
+}
+
+/* Adds tags of all rules matching node path relative to device root */
+int
+udev_rules_get_tags(struct udev_rules *ur, const char *relpath,
+    struct udev_list *tags)
+{
+	struct udev_rule *rule;
+
+	STAILQ_FOREACH(rule, &ur->rules, next)
+		if (fnmatch(rule->pattern, relpath, 0) == 0 &&
+		    udev_list_insert(tags, rule->tag, NULL) < 0)
+			return (-1);
+	return (0);
+}
@@ -0,0 +1,13 @@
+#ifndef UDEV_RULES_H_
+#define UDEV_RULES_H_
+
+#include "udev-list.h"
+
+struct udev_rules;
+
+struct udev_rules *udev_rules_load(const char *path);
+void udev_rules_free(struct udev_rules *ur);
+int udev_rules_get_tags(struct udev_rules *ur, const char *relpath,
+    struct udev_list *tags);
+
+#endif /* UDEV_RULES_H_ */
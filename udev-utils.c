@@ -26,14 +26,18 @@
 
 #include "config.h"
 #include "libudev.h"
+#include "udev.h"
 #include "udev-device.h"
 #include "udev-list.h"
+#include "udev-rules.h"
 #include "udev-utils.h"
+#include "evdev-caps.h"
+#include "sysctl-cache.h"
 #include "utils.h"
 
 #include <sys/param.h>
 #include <sys/types.h>
-#include <sys/sysctl.h>
+#include <sys/stat.h>
 
 #include <fcntl.h>
 #include <fnmatch.h>
@@ -71,73 +75,85 @@ void create_touchscreen_handler(struct udev_device *udev_device);
 void create_sysmouse_handler(struct udev_device *udev_device);
 void create_kbdmux_handler(struct udev_device *udev_device);
 
+/* syspath patterns are relative to device root of udev context */
 struct subsystem_config {
 	char *subsystem;
 	char *syspath;
+	char *devtype;
+	char *tags;	/* space separated */
 	int flags; /* See SCFLAG_* below. */
 	void (*create_handler)(struct udev_device *udev_device);
 };
 
-enum {
-	IT_NONE,
-	IT_KEYBOARD,
-	IT_MOUSE,
-	IT_TOUCHPAD,
-	IT_TOUCHSCREEN,
-	IT_JOYSTICK,
-	IT_TABLET
-};
-
 /* Flag which in indicates a device should be skipped because it's
  * already exposed through EVDEV when it's enabled. */
 #define	SCFLAG_SKIP_IF_EVDEV	0x01
 
 struct subsystem_config subsystems[] = {
 #ifdef HAVE_LINUX_INPUT_H
-	{ "input", DEV_PATH_ROOT "/input/event[0-9]*",
+	{ "input", "input/event[0-9]*", "event", "seat",
 		0,
 		create_evdev_handler },
 #endif
-	{ "input", DEV_PATH_ROOT "/ukbd[0-9]*",
+	{ "input", "ukbd[0-9]*", "kbd", "seat",
 		SCFLAG_SKIP_IF_EVDEV,
 		create_keyboard_handler },
-	{ "input", DEV_PATH_ROOT "/atkbd[0-9]*",
+	{ "input", "atkbd[0-9]*", "kbd", "seat",
 		SCFLAG_SKIP_IF_EVDEV,
 		create_keyboard_handler },
-	{ "input", DEV_PATH_ROOT "/kbdmux[0-9]*",
+	{ "input", "kbdmux[0-9]*", "kbd", "seat",
 		SCFLAG_SKIP_IF_EVDEV,
 		create_kbdmux_handler },
-	{ "input", DEV_PATH_ROOT "/ums[0-9]*",
+	{ "input", "ums[0-9]*", "mouse", "seat",
 		SCFLAG_SKIP_IF_EVDEV,
 		create_mouse_handler },
-	{ "input", DEV_PATH_ROOT "/psm[0-9]*",
+	{ "input", "psm[0-9]*", "mouse", "seat",
 		SCFLAG_SKIP_IF_EVDEV,
 		create_mouse_handler },
-	{ "input", DEV_PATH_ROOT "/joy[0-9]*",
+	{ "input", "joy[0-9]*", "joystick", "seat uaccess",
 		0,
 		create_joystick_handler },
-	{ "input", DEV_PATH_ROOT "/atp[0-9]*",
+	{ "input", "atp[0-9]*", "touchpad", "seat",
 		0,
 		create_touchpad_handler },
-	{ "input", DEV_PATH_ROOT "/wsp[0-9]*",
+	{ "input", "wsp[0-9]*", "touchpad", "seat",
 		0,
 		create_touchpad_handler },
-	{ "input", DEV_PATH_ROOT "/uep[0-9]*",
+	{ "input", "uep[0-9]*", "touchscreen", "seat",
 		0,
 		create_touchscreen_handler },
-	{ "input", DEV_PATH_ROOT "/sysmouse",
+	{ "input", "sysmouse", "mouse", "seat",
 		SCFLAG_SKIP_IF_EVDEV,
 		create_sysmouse_handler },
-	{ "input", DEV_PATH_ROOT "/vboxguest",
+	{ "input", "vboxguest", "mouse", "seat",
 		0,
 		create_mouse_handler },
 };
 
+/* Strips device root of udev context from syspath */
+const char *
+get_relpath_by_syspath(struct udev *udev, const char *syspath)
+{
+	const char *root;
+	size_t len;
+
+	root = udev_get_dev_path(udev);
+	len = strlen(root);
+	if (strncmp(syspath, root, len) != 0 || syspath[len] != '/')
+		return (NULL);
+
+	return (syspath + len + 1);
+}
+
 static struct subsystem_config *
-get_subsystem_config_by_syspath(const char *path)
+get_subsystem_config_by_syspath(struct udev *udev, const char *path)
 {
 	size_t i;
 
+	path = get_relpath_by_syspath(udev, path);
+	if (path == NULL)
+		return (NULL);
+
 	for (i = 0; i < nitems(subsystems); i++)
 		if (fnmatch(subsystems[i].syspath, path, 0) == 0)
 			return (&subsystems[i]);
@@ -154,19 +170,63 @@ kernel_has_evdev_enabled()
 	if (enabled != -1)
 		return (enabled);
 
-	if (sysctlbyname("kern.features.evdev_support", &enabled, &len, NULL, 0) < 0)
+	len = sizeof(enabled);
+	if (sysctl_cache_get("kern.features.evdev_support", &enabled, &len) < 0)
 		return (0);
 
 	TRC("() EVDEV enabled: %s", enabled ? "true" : "false");
 	return (enabled);
 }
 
+/* Device type is derived from node name like subsystem */
+const char *
+get_devtype_by_syspath(struct udev *udev, const char *syspath)
+{
+	struct subsystem_config *sc;
+
+	sc = get_subsystem_config_by_syspath(udev, syspath);
+	return (sc != NULL ? sc->devtype : NULL);
+}
+
+/* Adds tags of subsystem pattern and tag rules matching the device */
+int
+get_tags_by_syspath(struct udev *udev, const char *syspath,
+    struct udev_list *tags)
+{
+	struct subsystem_config *sc;
+	const char *relpath, *tag;
+	char buf[32];
+	size_t len;
+
+	/* Also skips devices shadowed by evdev */
+	if (strcmp(get_subsystem_by_syspath(udev, syspath),
+	    UNKNOWN_SUBSYSTEM) == 0)
+		return (0);
+
+	relpath = get_relpath_by_syspath(udev, syspath);
+	sc = get_subsystem_config_by_syspath(udev, syspath);
+	if (sc->tags != NULL) {
+		for (tag = sc->tags; *tag != '\0'; tag += len) {
+			tag += strspn(tag, " ");
+			len = strcspn(tag, " ");
+			if (len == 0 || len >= sizeof(buf))
+				continue;
+			memcpy(buf, tag, len);
+			buf[len] = '\0';
+			if (udev_list_insert(tags, buf, NULL) < 0)
+				return (-1);
+		}
+	}
+
+	return (udev_rules_get_tags(udev_get_rules(udev), relpath, tags));
+}
+
 const char *
-get_subsystem_by_syspath(const char *syspath)
+get_subsystem_by_syspath(struct udev *udev, const char *syspath)
 {
 	struct subsystem_config *sc;
 
-	sc = get_subsystem_config_by_syspath(syspath);
+	sc = get_subsystem_config_by_syspath(udev, syspath);
 	if (sc == NULL)
 		return (UNKNOWN_SUBSYSTEM);
 	if (sc->flags & SCFLAG_SKIP_IF_EVDEV && kernel_has_evdev_enabled()) {
@@ -177,6 +237,53 @@ get_subsystem_by_syspath(const char *syspath)
 	return (sc->subsystem);
 }
 
+/*
+ * Resolves syspath of existing device node with given subsystem and sysname
+ * by probing directories of matching compiled subsystem patterns.
+ */
+int
+get_syspath_by_subsystem_sysname(struct udev *udev, const char *subsystem,
+    const char *sysname, char *syspath, size_t len, dev_t *devnum)
+{
+	char devpath[DEV_PATH_MAX];
+	const char *dirend;
+	struct stat st;
+	size_t i;
+
+	if (strchr(sysname, '/') != NULL)
+		return (-1);
+
+	for (i = 0; i < nitems(subsystems); i++) {
+		if (strcmp(subsystems[i].subsystem, subsystem) != 0)
+			continue;
+		dirend = strrchr(subsystems[i].syspath, '/');
+		if (dirend == NULL)
+			dirend = subsystems[i].syspath;
+		else
+			dirend++;
+		if (snprintf(devpath, sizeof(devpath), "%s/%.*s%s",
+		    udev_get_dev_path(udev),
+		    (int)(dirend - subsystems[i].syspath),
+		    subsystems[i].syspath, sysname) >= (int)sizeof(devpath))
+			continue;
+		if (fnmatch(subsystems[i].syspath,
+		    get_relpath_by_syspath(udev, devpath), 0) != 0)
+			continue;
+		/* Pattern can be shadowed by preceding or evdev-only one */
+		if (strcmp(get_subsystem_by_syspath(udev, devpath),
+		    subsystem) != 0)
+			return (-1);
+		if (stat(devpath, &st) != 0 || !S_ISCHR(st.st_mode))
+			return (-1);
+		if (strlcpy(syspath, get_syspath_by_devpath(devpath), len) >= len)
+			return (-1);
+		*devnum = st.st_rdev;
+		return (0);
+	}
+
+	return (-1);
+}
+
 const char *
 get_sysname_by_syspath(const char *syspath)
 {
@@ -205,7 +312,7 @@ invoke_create_handler(struct udev_device *ud)
 	struct subsystem_config *sc;
 
 	path = udev_device_get_syspath(ud);
-	sc = get_subsystem_config_by_syspath(path);
+	sc = get_subsystem_config_by_syspath(udev_device_get_udev(ud), path);
 	if (sc == NULL || sc->create_handler == NULL)
 		return;
 	if (sc->flags & SCFLAG_SKIP_IF_EVDEV && kernel_has_evdev_enabled()) {
@@ -213,6 +320,9 @@ invoke_create_handler(struct udev_device *ud)
 		return;
 	}
 
+	if (sc->devtype != NULL)
+		udev_list_insert(udev_device_get_properties_list(ud),
+		    "DEVTYPE", sc->devtype);
 	sc->create_handler(ud);
 }
 
@@ -249,20 +359,100 @@ set_input_device_type(struct udev_device *ud, int input_type)
 	return (0);
 }
 
+/* Splits newbus device name like "uhub1" to driver name and unit number */
+static int
+split_newbus_name(const char *nameunit, char *devname, size_t len,
+    const char **unit)
+{
+	size_t namelen;
+
+	namelen = syspathlen_wo_units(nameunit);
+	if (namelen == 0 || nameunit[namelen] == '\0' || namelen >= len)
+		return (-1);
+	memcpy(devname, nameunit, namelen);
+	devname[namelen] = '\0';
+	*unit = nameunit + namelen;
+	return (0);
+}
+
+/*
+ * Fills ancestor device properties and sysattrs from its newbus data. ns is
+ * NULL if caller has not fetched the data already.
+ */
+static void
+set_newbus_props(struct udev_device *ud, const char *devname,
+    const char *unit, const struct newbus_sysctls *ns)
+{
+	struct newbus_sysctls nsbuf;
+	char bus[80], buf[16];
+	const char *busunit, *vendorstr, *prodstr, *devicestr;
+	struct udev_list *props, *sysattrs;
+	size_t vendorlen, prodlen, devicelen;
+
+	props = udev_device_get_properties_list(ud);
+	sysattrs = udev_device_get_sysattr_list(ud);
+	udev_list_insert(props, "DRIVER", devname);
+	if (ns == NULL) {
+		if (sysctl_cache_get_newbus(devname, unit, &nsbuf) < 0)
+			return;
+		ns = &nsbuf;
+	}
+	if (ns->desc[0] != '\0')
+		udev_list_insert(sysattrs, "name", ns->desc);
+	if (split_newbus_name(ns->parent, bus, sizeof(bus), &busunit) < 0)
+		return;
+
+	/* Subsystem is determined by the bus device is attached to */
+	vendorstr = get_kern_prop_value(ns->pnpinfo, "vendor", &vendorlen);
+	prodstr = get_kern_prop_value(ns->pnpinfo, "product", &prodlen);
+	devicestr = get_kern_prop_value(ns->pnpinfo, "device", &devicelen);
+	if (strcmp(bus, "uhub") == 0 &&
+	    vendorstr != NULL && prodstr != NULL) {
+		udev_list_insert(props, "SUBSYSTEM", "usb");
+		udev_list_insert(props, "DEVTYPE", "usb_device");
+		snprintf(buf, sizeof(buf), "%04x",
+		    (unsigned int)strtol(vendorstr, NULL, 0));
+		udev_list_insert(sysattrs, "idVendor", buf);
+		snprintf(buf, sizeof(buf), "%04x",
+		    (unsigned int)strtol(prodstr, NULL, 0));
+		udev_list_insert(sysattrs, "idProduct", buf);
+	} else if (strcmp(bus, "pci") == 0 &&
+	    vendorstr != NULL && devicestr != NULL) {
+		udev_list_insert(props, "SUBSYSTEM", "pci");
+		snprintf(buf, sizeof(buf), "0x%04x",
+		    (unsigned int)strtol(vendorstr, NULL, 0));
+		udev_list_insert(sysattrs, "vendor", buf);
+		snprintf(buf, sizeof(buf), "0x%04x",
+		    (unsigned int)strtol(devicestr, NULL, 0));
+		udev_list_insert(sysattrs, "device", buf);
+	}
+}
+
+/*
+ * Creates parent carrying name and product of the device node. It is not
+ * shared as nodes with the same phys, e.g. uinput devices without one or
+ * psm touchpad and trackpoint, have different names. Newbus ancestors above
+ * it are shared.
+ */
 static struct udev_device *
 create_xorg_parent(struct udev_device *ud, const char* sysname,
-    const char *name, const char *product, const char *pnp_id)
+    const char *name, const char *product, const char *pnp_id,
+    const struct newbus_sysctls *ns)
 {
 	struct udev_device *parent;
-	struct udev *udev;
 	struct udev_list *props, *sysattrs;
+	char devname[80];
+	const char *unit;
 
 	/* xorg-server gets device name and vendor string from parent device */
-	udev = udev_device_get_udev(ud);
-	parent = udev_device_new_common(udev, sysname, UD_ACTION_NONE);
+	parent = udev_device_new_parent(udev_device_get_udev(ud), sysname);
 	if (parent == NULL)
 		return NULL;
 
+	/* Parent named after newbus device is an ancestor of its own */
+	if (split_newbus_name(sysname, devname, sizeof(devname), &unit) == 0)
+		set_newbus_props(parent, devname, unit, ns);
+
 	props = udev_device_get_properties_list(parent);
 	sysattrs = udev_device_get_sysattr_list(parent);
 	udev_list_insert(props, "NAME", name);
@@ -277,43 +467,20 @@ create_xorg_parent(struct udev_device *ud, const char* sysname,
 
 #ifdef HAVE_LINUX_INPUT_H
 
-#define	LONG_BITS	(sizeof(long) * 8)
-#define	NLONGS(x)	(((x) + LONG_BITS - 1) / LONG_BITS)
-
-static inline bool
-bit_is_set(const unsigned long *array, int bit)
-{
-	return !!(array[bit / LONG_BITS] & (1LL << (bit % LONG_BITS)));
-}
-
-static inline bool
-bit_find(const unsigned long *array, int start, int stop)
-{
-	int i;
-
-	for (i = start; i < stop; i++)
-		if (bit_is_set(array, i))
-			return true;
-
-	return false;
-}
-
 void
 create_evdev_handler(struct udev_device *ud)
 {
 	struct udev_device *parent;
 	const char *sysname;
 	char name[80], product[80], phys[80];
-	int fd, input_type = IT_NONE;
+	int fd, input_type;
 	bool opened = false;
-	bool has_keys, has_buttons, has_lmr;
-	bool has_rel_axes, has_abs_axes, has_mt;
-	unsigned long key_bits[NLONGS(KEY_CNT)];
-	unsigned long rel_bits[NLONGS(REL_CNT)];
-	unsigned long abs_bits[NLONGS(ABS_CNT)];
+	struct evdev_caps caps;
 	struct input_id id;
 
-	fd = path_to_fd(udev_device_get_devnode(ud));
+	/* Bits not reported by kernel must read as zero */
+	memset(&caps, 0, sizeof(caps));
+	fd = udev_fd_find(udev_device_get_udev(ud), ud);
 	if (fd == -1) {
 		fd = open(udev_device_get_devnode(ud), O_RDONLY | O_CLOEXEC);
 		opened = true;
@@ -324,68 +491,31 @@ create_evdev_handler(struct udev_device *ud)
 	if (ioctl(fd, EVIOCGNAME(sizeof(name)), name) < 0 ||
 	    (ioctl(fd, EVIOCGPHYS(sizeof(phys)), phys) < 0 && errno != ENOENT) ||
 	    ioctl(fd, EVIOCGID, &id) < 0 ||
-	    ioctl(fd, EVIOCGBIT(EV_REL, sizeof(rel_bits)), rel_bits) < 0 ||
-	    ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(abs_bits)), abs_bits) < 0 ||
-	    ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(key_bits)), key_bits) < 0) {
+	    ioctl(fd, EVIOCGBIT(EV_REL, sizeof(caps.rel_bits)),
+	    caps.rel_bits) < 0 ||
+	    ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(caps.abs_bits)),
+	    caps.abs_bits) < 0 ||
+	    ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(caps.key_bits)),
+	    caps.key_bits) < 0) {
 		ERR("could not query evdev");
 		goto bail_out;
 	}
-
-	/* Derived from EvdevProbe() function of xf86-input-evdev driver */
-	has_keys = bit_find(key_bits, 0, BTN_MISC);
-	has_buttons = bit_find(key_bits, BTN_MISC, BTN_JOYSTICK);
-	has_lmr = bit_find(key_bits, BTN_LEFT, BTN_MIDDLE + 1);
-	has_rel_axes = bit_find(rel_bits, 0, REL_CNT);
-	has_abs_axes = bit_find(abs_bits, 0, ABS_CNT);
-	has_mt = bit_find(abs_bits, ABS_MT_SLOT, ABS_CNT);
-
-	if (has_abs_axes) {
-		if (has_mt && !has_buttons) {
-			/* TBD:Improve joystick detection */
-			if (bit_is_set(key_bits, BTN_JOYSTICK)) {
-				input_type = IT_JOYSTICK;
-				goto detected;
-			} else {
-				has_buttons = true;
-			}
-		}
-
-		if (bit_is_set(abs_bits, ABS_X) &&
-		    bit_is_set(abs_bits, ABS_Y)) {
-			if (bit_is_set(key_bits, BTN_TOOL_PEN) ||
-			    bit_is_set(key_bits, BTN_STYLUS) ||
-			    bit_is_set(key_bits, BTN_STYLUS2)) {
-				input_type = IT_TABLET;
-				goto detected;
-			} else if (bit_is_set(abs_bits, ABS_PRESSURE) ||
-			           bit_is_set(key_bits, BTN_TOUCH)) {
-				if (has_lmr ||
-				    bit_is_set(key_bits, BTN_TOOL_FINGER)) {
-					input_type = IT_TOUCHPAD;
-				} else {
-					input_type = IT_TOUCHSCREEN;
-				}
-				goto detected;
-			} else if (!(bit_is_set(rel_bits, REL_X) &&
-			             bit_is_set(rel_bits, REL_Y)) &&
-			             has_lmr) {
-				/* some touchscreens use BTN_LEFT rather than BTN_TOUCH */
-				input_type = IT_TOUCHSCREEN;
-				goto detected;
-			}
-		}
-	}
-
-	if (has_keys)
-		input_type = IT_KEYBOARD;
-	else if (has_rel_axes || has_abs_axes || has_buttons)
-		input_type = IT_MOUSE;
-
+	/* Not required for classification, only exported as properties */
+	if (ioctl(fd, EVIOCGBIT(0, sizeof(caps.ev_bits)), caps.ev_bits) < 0)
+		memset(caps.ev_bits, 0, sizeof(caps.ev_bits));
+	if (ioctl(fd, EVIOCGBIT(EV_MSC, sizeof(caps.msc_bits)),
+	    caps.msc_bits) < 0)
+		memset(caps.msc_bits, 0, sizeof(caps.msc_bits));
+	if (ioctl(fd, EVIOCGBIT(EV_SW, sizeof(caps.sw_bits)),
+	    caps.sw_bits) < 0)
+		memset(caps.sw_bits, 0, sizeof(caps.sw_bits));
+
+	input_type = evdev_caps_classify(&caps);
 	if (input_type == IT_NONE)
 		goto bail_out;
 
-detected:
 	set_input_device_type(ud, input_type);
+	udev_device_set_evdev_caps(ud, &caps);
 
 	sysname = phys[0] == 0 ? virtual_sysname : phys;
 
@@ -394,7 +524,7 @@ detected:
 	snprintf(product, sizeof(product), "%x/%x/%x/%x",
 	    id.bustype, id.vendor, id.product, id.version);
 
-	parent = create_xorg_parent(ud, sysname, name, product, NULL);
+	parent = create_xorg_parent(ud, sysname, name, product, NULL, NULL);
 	if (parent != NULL)
 		udev_device_set_parent(ud, parent);
 
@@ -421,9 +551,9 @@ void
 set_parent(struct udev_device *ud)
 {
         struct udev_device *parent;
-	char devname[DEV_PATH_MAX], mib[32], pnpinfo[1024];
-	char name[80], product[80], parentname[80], *pnp_id;
-	const char *sysname, *unit, *vendorstr, *prodstr, *devicestr;
+	struct newbus_sysctls ns;
+	char devname[DEV_PATH_MAX], product[80], pnp_buf[32];
+	const char *sysname, *unit, *vendorstr, *prodstr, *devicestr, *pnp_id;
 	size_t len, vendorlen, prodlen, devicelen, pnplen;
 	uint32_t bus, prod, vendor;
 
@@ -435,30 +565,21 @@ set_parent(struct udev_device *ud)
 	snprintf(devname, len + 1, "%s", sysname);
 	unit = sysname + len;
 
-	snprintf(mib, sizeof(mib), "dev.%s.%s.%%desc", devname, unit);
-	len = sizeof(name);
-	if (sysctlbyname(mib, name, &len, NULL, 0) < 0)
-		return;
-	*(strchrnul(name, ',')) = '\0';	/* strip name */
-
-	snprintf(mib, sizeof(mib), "dev.%s.%s.%%pnpinfo", devname, unit);
-	len = sizeof(pnpinfo);
-	if (sysctlbyname(mib, pnpinfo, &len, NULL, 0) < 0)
-		return;
-
-	snprintf(mib, sizeof(mib), "dev.%s.%s.%%parent", devname, unit);
-	len = sizeof(parentname);
-	if (sysctlbyname(mib, parentname, &len, NULL, 0) < 0)
+	if (sysctl_cache_get_newbus(devname, unit, &ns) < 0)
 		return;
+	*(strchrnul(ns.desc, ',')) = '\0';	/* strip name */
 
-	vendorstr = get_kern_prop_value(pnpinfo, "vendor", &vendorlen);
-	prodstr = get_kern_prop_value(pnpinfo, "product", &prodlen);
-	devicestr = get_kern_prop_value(pnpinfo, "device", &devicelen);
-	pnp_id = get_kern_prop_value(pnpinfo, "_HID", &pnplen);
+	vendorstr = get_kern_prop_value(ns.pnpinfo, "vendor", &vendorlen);
+	prodstr = get_kern_prop_value(ns.pnpinfo, "product", &prodlen);
+	devicestr = get_kern_prop_value(ns.pnpinfo, "device", &devicelen);
+	pnp_id = get_kern_prop_value(ns.pnpinfo, "_HID", &pnplen);
 	if (pnp_id != NULL && pnplen == 4 && strncmp(pnp_id, "none", 4) == 0)
 		pnp_id = NULL;
-	if (pnp_id != NULL)
-		pnp_id[pnplen] = '\0';
+	/* pnpinfo is passed on intact to fill parent props */
+	if (pnp_id != NULL) {
+		snprintf(pnp_buf, sizeof(pnp_buf), "%.*s", (int)pnplen, pnp_id);
+		pnp_id = pnp_buf;
+	}
 	if (prodstr != NULL && vendorstr != NULL) {
 		/* XXX: should parent be compared to uhub* to detect usb? */
 		vendor = strtol(vendorstr, NULL, 0);
@@ -468,7 +589,7 @@ set_parent(struct udev_device *ud)
 		vendor = strtol(vendorstr, NULL, 0);
 		prod = strtol(devicestr, NULL, 0);
 		bus = BUS_PCI;
-	} else if (strcmp(parentname, "atkbdc0") == 0) {
+	} else if (strcmp(ns.parent, "atkbdc0") == 0) {
 		if (strcmp(devname, "atkbd") == 0) {
 			vendor = PS2_KEYBOARD_VENDOR;
 			prod = PS2_KEYBOARD_PRODUCT;
@@ -486,13 +607,56 @@ set_parent(struct udev_device *ud)
 		bus = BUS_VIRTUAL;
 	}
 	snprintf(product, sizeof(product), "%x/%x/%x/0", bus, vendor, prod);
-	parent = create_xorg_parent(ud, sysname, name, product, pnp_id);
+	parent = create_xorg_parent(ud, sysname, ns.desc, product, pnp_id,
+	    &ns);
 	if (parent != NULL)
 		udev_device_set_parent(ud, parent);
 
 	return;
 }
 
+/*
+ * Returns referenced ancestor device built from newbus parent of device
+ * which sysname is newbus device name, e.g. ukbd0 -> uhub1 -> usbus0 ->
+ * xhci0 -> pci0. Ancestors are shared between all descendants.
+ */
+struct udev_device *
+get_newbus_parent(struct udev_device *ud)
+{
+	struct udev_device *parent;
+	struct udev *udev;
+	char devname[80], parentname[80];
+	char mib[sizeof("dev..%parent") + sizeof(devname) + DEV_PATH_MAX];
+	const char *sysname, *unit;
+	int len;
+
+	sysname = udev_device_get_sysname(ud);
+	if (sysname == NULL)
+		sysname = udev_device_get_syspath(ud);
+	if (split_newbus_name(sysname, devname, sizeof(devname), &unit) < 0)
+		return (NULL);
+	/* Do not query sysctl by truncated name */
+	len = snprintf(mib, sizeof(mib), "dev.%s.%s.%%parent", devname, unit);
+	if (len < 0 || (size_t)len >= sizeof(mib))
+		return (NULL);
+	if (sysctl_cache_get_string(mib, parentname, sizeof(parentname)) < 0 ||
+	    parentname[0] == '\0')
+		return (NULL);
+
+	udev = udev_device_get_udev(ud);
+	parent = udev_parent_find(udev, parentname);
+	if (parent != NULL)
+		return (parent);
+
+	parent = udev_device_new_parent(udev, parentname);
+	if (parent == NULL)
+		return (NULL);
+	if (split_newbus_name(parentname, devname, sizeof(devname), &unit) == 0)
+		set_newbus_props(parent, devname, unit, NULL);
+
+	return (udev_parent_insert(udev, parent));
+}
+
 void
 create_keyboard_handler(struct udev_device *ud)
 {
@@ -518,7 +682,7 @@ create_kbdmux_handler(struct udev_device *ud)
 	set_input_device_type(ud, IT_KEYBOARD);
 	sysname = udev_device_get_sysname(ud);
 	parent = create_xorg_parent(ud, sysname,
-	    "System keyboard multiplexor", "6/1/1/0", NULL);
+	    "System keyboard multiplexor", "6/1/1/0", NULL, NULL);
 	if (parent != NULL)
 		udev_device_set_parent(ud, parent);
 }
@@ -532,7 +696,7 @@ create_sysmouse_handler(struct udev_device *ud)
 	set_input_device_type(ud, IT_MOUSE);
 	sysname = udev_device_get_sysname(ud);
 	parent = create_xorg_parent(ud, sysname,
-	    "System mouse", "6/2/1/0", NULL);
+	    "System mouse", "6/2/1/0", NULL, NULL);
 	if (parent != NULL)
 		udev_device_set_parent(ud, parent);
 }
@@ -1,6 +1,8 @@
 #ifndef UDEV_UTILS_H_
 #define UDEV_UTILS_H_
 
+#include <sys/types.h>
+
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
@@ -12,15 +14,43 @@
 #define	DEV_PATH_ROOT	"/dev"
 #define	DEV_PATH_MAX	80
 #define	SYS_PATH_MAX	80
+#define	DEVD_SOCK_PATH	"/var/run/devd.pipe"
+#define	DEVD_SEQPACKET_SOCK_PATH	"/var/run/devd.seqpacket.pipe"
+#define	DEVD_SOCK_PATH_MAX	104	/* sizeof(sockaddr_un.sun_path) */
+#ifndef SYSCONFDIR
+#define	SYSCONFDIR	"/usr/local/etc"
+#endif
+#define	TAG_RULES_PATH	SYSCONFDIR "/libudev-devd/tags.rules"
 
 #define	UNKNOWN_SUBSYSTEM	"#"
 
-const char *get_subsystem_by_syspath(const char *syspath);
+struct udev_list;
+
+/* Input device types */
+enum {
+	IT_NONE,
+	IT_KEYBOARD,
+	IT_MOUSE,
+	IT_TOUCHPAD,
+	IT_TOUCHSCREEN,
+	IT_JOYSTICK,
+	IT_TABLET
+};
+
+const char *get_subsystem_by_syspath(struct udev *udev, const char *syspath);
+const char *get_devtype_by_syspath(struct udev *udev, const char *syspath);
+int get_tags_by_syspath(struct udev *udev, const char *syspath,
+    struct udev_list *tags);
 const char *get_sysname_by_syspath(const char *syspath);
 const char *get_devpath_by_syspath(const char *syspath);
 const char *get_syspath_by_devpath(const char *devpath);
+const char *get_relpath_by_syspath(struct udev *udev, const char *syspath);
+int get_syspath_by_subsystem_sysname(struct udev *udev,
+    const char *subsystem, const char *sysname, char *syspath, size_t len,
+    dev_t *devnum);
 
 void invoke_create_handler(struct udev_device *ud);
+struct udev_device *get_newbus_parent(struct udev_device *ud);
 size_t syspathlen_wo_units(const char *path);
 
 #endif /* UDEV_UTILS_H_ */
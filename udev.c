@@ -27,37 +27,166 @@
 #include "config.h"
 #include "libudev.h"
 #include "udev.h"
+#include "udev-device.h"
+#include "udev-index.h"
+#include "udev-rules.h"
 #include "udev-utils.h"
 #include "utils.h"
 
+#include <sys/types.h>
+#include <sys/tree.h>
+
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <pthread.h>
 #include <stdatomic.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+/*
+ * Synthetic parent devices are shared between all children with the same
+ * syspath. The table does not hold references, so a parent leaves it when
+ * the last child releases it.
+ */
+struct udev_parent_entry {
+	RB_ENTRY(udev_parent_entry) link;
+	struct udev_device *ud;
+	const char *syspath;
+};
+
+RB_HEAD(udev_parent_tree, udev_parent_entry);
+
+/*
+ * Open files of the process keyed by identity of the vnode, so probing can
+ * reuse fds already held by consumer without scanning the file table.
+ */
+struct udev_fd_entry {
+	RB_ENTRY(udev_fd_entry) link;
+	dev_t dev;
+	ino_t ino;
+	int fd;
+	bool registered;
+};
+
+RB_HEAD(udev_fd_tree, udev_fd_entry);
 
 struct udev {
 	_Atomic(int) refcount;
+	_Atomic(int) users;	/* devices and monitors built on paths */
 	void *userdata;
+	pthread_mutex_t parent_mtx;
+	struct udev_parent_tree parents;
+	struct udev_index *index;
+	struct udev_rules *rules;
+	struct udev_dispatcher *dispatcher;
+	char dev_root[DEV_PATH_MAX];
+	char devd_socket[DEVD_SOCK_PATH_MAX];
+	pthread_mutex_t fd_mtx;
+	struct udev_fd_tree fds;
+	int registered_fds;
 };
 
+static int
+udev_parent_entry_cmp(struct udev_parent_entry *upe1,
+    struct udev_parent_entry *upe2)
+{
+
+	return (strcmp(upe1->syspath, upe2->syspath));
+}
+
+RB_GENERATE_STATIC(udev_parent_tree, udev_parent_entry, link,
+    udev_parent_entry_cmp);
+
+static int
+udev_fd_entry_cmp(struct udev_fd_entry *ufe1, struct udev_fd_entry *ufe2)
+{
+
+	if (ufe1->dev != ufe2->dev)
+		return (ufe1->dev < ufe2->dev ? -1 : 1);
+	if (ufe1->ino != ufe2->ino)
+		return (ufe1->ino < ufe2->ino ? -1 : 1);
+	return (0);
+}
+
+RB_GENERATE_STATIC(udev_fd_tree, udev_fd_entry, link, udev_fd_entry_cmp);
+
+/* Copies absolute path without trailing slashes */
+static int
+udev_set_path(char *dst, size_t len, const char *path)
+{
+	size_t pathlen;
+
+	pathlen = strlen(path);
+	while (pathlen > 1 && path[pathlen - 1] == '/')
+		pathlen--;
+	if (path[0] != '/' || pathlen >= len) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	memcpy(dst, path, pathlen);
+	dst[pathlen] = '\0';
+	return (0);
+}
+
 LIBUDEV_EXPORT struct udev *
 udev_new(void)
 {
 	struct udev *udev;
+	const char *path;
 
 	TRC();
 	udev = calloc(1, sizeof(struct udev));
 	if (udev) {
+		udev->index = udev_index_new(udev);
+		if (udev->index == NULL) {
+			free(udev);
+			return (NULL);
+		}
+		path = getenv_secure("LIBUDEV_TAG_RULES");
+		udev->rules = udev_rules_load(path != NULL ?
+		    path : TAG_RULES_PATH);
+		if (udev->rules == NULL) {
+			udev_index_free(udev->index);
+			free(udev);
+			return (NULL);
+		}
+		/*
+		 * Environment lets benchmarks run against fake devd and /dev.
+		 * Set-user-ID programs must not trust it.
+		 */
+		path = getenv_secure("LIBUDEV_DEV_ROOT");
+		if (path == NULL ||
+		    udev_set_path(udev->dev_root, sizeof(udev->dev_root),
+		    path) < 0)
+			strcpy(udev->dev_root, DEV_PATH_ROOT);
+		path = getenv_secure("LIBUDEV_DEVD_SOCKET");
+		if (path == NULL ||
+		    udev_set_path(udev->devd_socket,
+		    sizeof(udev->devd_socket), path) < 0)
+			strcpy(udev->devd_socket, DEVD_SOCK_PATH);
 		atomic_init(&udev->refcount, 1);
+		atomic_init(&udev->users, 0);
 		udev->userdata = NULL;
+		pthread_mutex_init(&udev->parent_mtx, NULL);
+		RB_INIT(&udev->parents);
+		pthread_mutex_init(&udev->fd_mtx, NULL);
+		RB_INIT(&udev->fds);
+		udev->registered_fds = 0;
 	}
 
 	return (udev);
 }
 
+/* Reference held by device or monitor. Pins dev path until released */
 struct udev *
 _udev_ref(struct udev *udev)
 {
 
+	atomic_fetch_add(&udev->users, 1);
 	atomic_fetch_add(&udev->refcount, 1);
 	return udev;
 }
@@ -67,15 +196,34 @@ udev_ref(struct udev *udev)
 {
 
 	TRC("(%p) refcount=%d", udev, udev->refcount);
-	return (_udev_ref(udev));
+	atomic_fetch_add(&udev->refcount, 1);
+	return (udev);
+}
+
+static void
+udev_release(struct udev *udev)
+{
+	struct udev_fd_entry *ufe1, *ufe2;
+
+	if (atomic_fetch_sub(&udev->refcount, 1) == 1) {
+		pthread_mutex_destroy(&udev->parent_mtx);
+		RB_FOREACH_SAFE(ufe1, udev_fd_tree, &udev->fds, ufe2) {
+			RB_REMOVE(udev_fd_tree, &udev->fds, ufe1);
+			free(ufe1);
+		}
+		pthread_mutex_destroy(&udev->fd_mtx);
+		udev_index_free(udev->index);
+		udev_rules_free(udev->rules);
+		free(udev);
+	}
 }
 
 void
 _udev_unref(struct udev *udev)
 {
 
-	if (atomic_fetch_sub(&udev->refcount, 1) == 1)
-		free(udev);
+	atomic_fetch_sub(&udev->users, 1);
+	udev_release(udev);
 }
 
 LIBUDEV_EXPORT void
@@ -83,15 +231,77 @@ udev_unref(struct udev *udev)
 {
 
 	TRC("(%p) refcount=%d", udev, udev->refcount);
-	_udev_unref(udev);
+	udev_release(udev);
 }
 
 LIBUDEV_EXPORT const char *
-udev_get_dev_path(struct udev *udev __unused)
+udev_get_dev_path(struct udev *udev)
 {
 
-	TRC();
-	return (DEV_PATH_ROOT);
+	return (udev->dev_root);
+}
+
+/* Fails with EBUSY while any device or monitor of the context exists */
+LIBUDEV_EXPORT int
+udev_set_dev_path(struct udev *udev, const char *path)
+{
+
+	TRC("(%p, %s)", udev, path);
+	if (atomic_load(&udev->users) != 0) {
+		errno = EBUSY;
+		return (-1);
+	}
+	if (udev_set_path(udev->dev_root, sizeof(udev->dev_root), path) < 0)
+		return (-1);
+	/* Indexed syspaths are built on the old path */
+	udev_index_flush(udev->index);
+	return (0);
+}
+
+LIBUDEV_EXPORT const char *
+udev_get_devd_socket(struct udev *udev)
+{
+
+	TRC("(%p)", udev);
+	return (udev->devd_socket);
+}
+
+/* Affects monitors started afterwards */
+LIBUDEV_EXPORT int
+udev_set_devd_socket(struct udev *udev, const char *path)
+{
+
+	TRC("(%p, %s)", udev, path);
+	return (udev_set_path(udev->devd_socket, sizeof(udev->devd_socket),
+	    path));
+}
+
+struct udev_index *
+udev_get_index(struct udev *udev)
+{
+
+	return (udev->index);
+}
+
+struct udev_rules *
+udev_get_rules(struct udev *udev)
+{
+
+	return (udev->rules);
+}
+
+struct udev_dispatcher *
+udev_get_dispatcher(struct udev *udev)
+{
+
+	return (udev->dispatcher);
+}
+
+void
+udev_set_dispatcher(struct udev *udev, struct udev_dispatcher *ud)
+{
+
+	udev->dispatcher = ud;
 }
 
 LIBUDEV_EXPORT void *
@@ -109,3 +319,172 @@ udev_set_userdata(struct udev *udev, void *userdata)
 	TRC();
 	udev->userdata = userdata;
 }
+
+/* Returns referenced parent device with given syspath or NULL */
+struct udev_device *
+udev_parent_find(struct udev *udev, const char *syspath)
+{
+	struct udev_parent_entry key, *upe;
+	struct udev_device *ud = NULL;
+
+	key.syspath = syspath;
+	pthread_mutex_lock(&udev->parent_mtx);
+	upe = RB_FIND(udev_parent_tree, &udev->parents, &key);
+	if (upe != NULL && udev_device_try_ref(upe->ud))
+		ud = upe->ud;
+	pthread_mutex_unlock(&udev->parent_mtx);
+
+	return (ud);
+}
+
+/*
+ * Publishes referenced parent device in the table. If other thread has
+ * published live parent with the same syspath first, the passed device is
+ * released and referenced winner is returned instead.
+ */
+struct udev_device *
+udev_parent_insert(struct udev *udev, struct udev_device *ud)
+{
+	struct udev_parent_entry *upe, *old_upe;
+
+	upe = calloc(1, sizeof(struct udev_parent_entry));
+	if (upe == NULL)
+		return (ud);
+
+	upe->ud = ud;
+	upe->syspath = udev_device_get_syspath(ud);
+	pthread_mutex_lock(&udev->parent_mtx);
+	old_upe = RB_INSERT(udev_parent_tree, &udev->parents, upe);
+	if (old_upe != NULL) {
+		free(upe);
+		if (udev_device_try_ref(old_upe->ud)) {
+			pthread_mutex_unlock(&udev->parent_mtx);
+			udev_device_unref(ud);
+			return (old_upe->ud);
+		}
+		/* Previous parent is being destroyed. Take its place */
+		old_upe->ud = ud;
+		old_upe->syspath = udev_device_get_syspath(ud);
+	}
+	udev_device_set_shared(ud);
+	pthread_mutex_unlock(&udev->parent_mtx);
+
+	return (ud);
+}
+
+/* Called on destruction of shared parent device */
+void
+udev_parent_remove(struct udev *udev, struct udev_device *ud)
+{
+	struct udev_parent_entry key, *upe;
+
+	key.syspath = udev_device_get_syspath(ud);
+	pthread_mutex_lock(&udev->parent_mtx);
+	upe = RB_FIND(udev_parent_tree, &udev->parents, &key);
+	if (upe != NULL && upe->ud == ud) {
+		RB_REMOVE(udev_parent_tree, &udev->parents, upe);
+		free(upe);
+	}
+	pthread_mutex_unlock(&udev->parent_mtx);
+}
+
+static int
+udev_fd_insert(struct udev *udev, int fd, bool registered)
+{
+	struct udev_fd_entry *ufe, *old_ufe;
+	struct stat st;
+
+	if (fstat(fd, &st) != 0)
+		return (-1);
+
+	ufe = calloc(1, sizeof(struct udev_fd_entry));
+	if (ufe == NULL)
+		return (-1);
+	ufe->dev = st.st_dev;
+	ufe->ino = st.st_ino;
+	ufe->fd = fd;
+	ufe->registered = registered;
+
+	pthread_mutex_lock(&udev->fd_mtx);
+	old_ufe = RB_INSERT(udev_fd_tree, &udev->fds, ufe);
+	if (old_ufe != NULL) {
+		if (old_ufe->registered)
+			udev->registered_fds--;
+		RB_REMOVE(udev_fd_tree, &udev->fds, old_ufe);
+		free(old_ufe);
+		RB_INSERT(udev_fd_tree, &udev->fds, ufe);
+	}
+	if (registered)
+		udev->registered_fds++;
+	pthread_mutex_unlock(&udev->fd_mtx);
+
+	return (0);
+}
+
+/*
+ * Returns fd the process already holds for devnode of the device or -1.
+ * Once consumer has registered its fds, the table is authoritative and
+ * the file table of the process is not scanned on misses.
+ */
+int
+udev_fd_find(struct udev *udev, struct udev_device *ud)
+{
+	struct udev_fd_entry key, *ufe;
+	struct stat st;
+	bool scan;
+	int fd = -1;
+
+	if (udev_device_get_identity(ud, &key.dev, &key.ino) != 0)
+		return (-1);
+
+	pthread_mutex_lock(&udev->fd_mtx);
+	ufe = RB_FIND(udev_fd_tree, &udev->fds, &key);
+	if (ufe != NULL) {
+		/* fd could be closed or reused since it has been recorded */
+		if (fstat(ufe->fd, &st) == 0 &&
+		    st.st_dev == key.dev && st.st_ino == key.ino) {
+			fd = ufe->fd;
+		} else {
+			if (ufe->registered)
+				udev->registered_fds--;
+			RB_REMOVE(udev_fd_tree, &udev->fds, ufe);
+			free(ufe);
+		}
+	}
+	scan = udev->registered_fds == 0;
+	pthread_mutex_unlock(&udev->fd_mtx);
+
+	if (fd == -1 && scan) {
+		fd = path_to_fd(udev_device_get_devnode(ud));
+		if (fd != -1)
+			udev_fd_insert(udev, fd, false);
+	}
+
+	return (fd);
+}
+
+LIBUDEV_EXPORT int
+udev_register_fd(struct udev *udev, int fd)
+{
+
+	TRC("(%p, %d)", udev, fd);
+	return (udev_fd_insert(udev, fd, true));
+}
+
+LIBUDEV_EXPORT void
+udev_unregister_fd(struct udev *udev, int fd)
+{
+	struct udev_fd_entry *ufe1, *ufe2;
+
+	TRC("(%p, %d)", udev, fd);
+	pthread_mutex_lock(&udev->fd_mtx);
+	RB_FOREACH_SAFE(ufe1, udev_fd_tree, &udev->fds, ufe2) {
+		if (ufe1->fd != fd)
+			continue;
+		if (ufe1->registered)
+			udev->registered_fds--;
+		RB_REMOVE(udev_fd_tree, &udev->fds, ufe1);
+		free(ufe1);
+	}
+	pthread_mutex_unlock(&udev->fd_mtx);
+}
@@ -5,5 +5,16 @@
 
 struct udev *_udev_ref(struct udev *udev);
 void _udev_unref(struct udev *udev);
+struct udev_dispatcher;
+
+struct udev_index *udev_get_index(struct udev *udev);
+struct udev_rules *udev_get_rules(struct udev *udev);
+struct udev_dispatcher *udev_get_dispatcher(struct udev *udev);
+void udev_set_dispatcher(struct udev *udev, struct udev_dispatcher *ud);
+struct udev_device *udev_parent_find(struct udev *udev, const char *syspath);
+struct udev_device *udev_parent_insert(struct udev *udev,
+    struct udev_device *ud);
+void udev_parent_remove(struct udev *udev, struct udev_device *ud);
+int udev_fd_find(struct udev *udev, struct udev_device *ud);
 
 #endif /* UDEV_H_ */
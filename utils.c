@@ -32,7 +32,9 @@
 #include <sys/un.h>
 #include <dirent.h>
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifdef HAVE_LIBPROCSTAT_H
@@ -57,12 +59,12 @@ static pthread_mutex_t devinfo_mtx = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
 int
-socket_connect(const char *path)
+socket_connect(const char *path, int type)
 {
 	struct sockaddr_un sa;
 	int fd;
 
-	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	fd = socket(AF_UNIX, type | SOCK_CLOEXEC, 0);
 	if (fd < 0)
                 return (-1);
 
@@ -77,21 +79,34 @@ socket_connect(const char *path)
 	return (fd);
 }
 
-ssize_t
-socket_readline(int fd, char *buf, size_t len)
+/* Returns CLOCK_MONOTONIC time in microseconds */
+uint64_t
+monotonic_usec(void)
 {
-	size_t pos;
+	struct timespec ts;
 
-	for (pos = 0; pos < len; ++pos) {
-		if (read(fd, buf + pos, 1) < 1)
-			return (-1);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
 
-		if (buf[pos] == 0 || buf[pos] == '\n') {
-			buf[pos] = 0;
-			return (pos);
-		}
-	}
-	return (-1);
+/*
+ * getenv() for debugging knobs naming files and sockets. Environment of
+ * set-user-ID or set-group-ID process is controlled by invoking user, so
+ * it is ignored there.
+ */
+const char *
+getenv_secure(const char *name)
+{
+
+#if defined(HAVE_ISSETUGID)
+	return (issetugid() ? NULL : getenv(name));
+#elif defined(HAVE_SECURE_GETENV)
+	return (secure_getenv(name));
+#else
+	if (getuid() != geteuid() || getgid() != getegid())
+		return (NULL);
+	return (getenv(name));
+#endif
 }
 
 /*
@@ -2,6 +2,7 @@
 #define UTILS_H_
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <unistd.h>
 
@@ -55,8 +56,9 @@ struct scan_ctx {
 char *strbase(const char *path);
 char *get_kern_prop_value(const char *buf, const char *prop, size_t *len);
 int match_kern_prop_value(const char *buf, const char *prop, const char *value);
-int socket_connect(const char *path);
-ssize_t socket_readline(int fd, char *buf, size_t len);
+int socket_connect(const char *path, int type);
+uint64_t monotonic_usec(void);
+const char *getenv_secure(const char *name);
 int path_to_fd(const char *path);
 int scandir_recursive(char *path, size_t len, struct scan_ctx *ctx);
 #ifdef HAVE_DEVINFO_H